@@ -0,0 +1,138 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+#include "semant-stats.h"
+
+// 线性（bump）分配器：按大块向系统申请内存，reset() 后所有块原样复用，
+// 不逐个释放对象，只适合存放不需要析构的简单数据
+class Arena {
+public:
+    explicit Arena(size_t block_size = 64 * 1024)
+        : block_size(block_size), current(0), ptr(NULL), end(NULL), total(0) {}
+
+    ~Arena() {
+        for (size_t i = 0; i < blocks.size(); i++) {
+            std::free(blocks[i].data);
+        }
+    }
+
+    void *allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+        char *p = align_up(ptr, align);
+        if (ptr == NULL || p + size > end) {
+            next_block(size + align);
+            p = align_up(ptr, align);
+        }
+        ptr = p + size;
+        SEMANT_COUNT(arena_allocations);
+        SEMANT_ADD(arena_bytes, size);
+        return p;
+    }
+
+    template <class T>
+    T *allocate_array(size_t n) {
+        return static_cast<T*>(allocate(n * sizeof(T), alignof(T)));
+    }
+
+    // 回到第一块的起点，已申请的块全部保留以供复用
+    void reset() {
+        current = 0;
+        if (blocks.empty()) {
+            ptr = end = NULL;
+        } else {
+            ptr = blocks[0].data;
+            end = ptr + blocks[0].size;
+        }
+    }
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    // 向系统申请的总字节数
+    size_t bytes_reserved() const { return total; }
+    size_t block_count() const { return blocks.size(); }
+
+private:
+    struct Block {
+        char *data;
+        size_t size;
+    };
+
+    std::vector<Block> blocks;
+    size_t block_size;
+    size_t current;     // 当前正在使用的块下标
+    char *ptr;
+    char *end;
+    size_t total;
+
+    static char *align_up(char *p, size_t align) {
+        size_t addr = reinterpret_cast<size_t>(p);
+        return reinterpret_cast<char*>((addr + align - 1) & ~(align - 1));
+    }
+
+    void next_block(size_t min_size) {
+        // 优先复用 reset() 之前申请过的、足够大的块
+        size_t next = ptr == NULL ? current : current + 1;
+        while (next < blocks.size() && blocks[next].size < min_size) next++;
+        if (next >= blocks.size()) {
+            size_t size = min_size > block_size ? min_size : block_size;
+            Block block;
+            block.data = static_cast<char*>(std::malloc(size));
+            if (block.data == NULL) throw std::bad_alloc();
+            block.size = size;
+            total += size;
+            SEMANT_ADD(arena_block_bytes, size);
+            blocks.push_back(block);
+            next = blocks.size() - 1;
+        }
+        current = next;
+        ptr = blocks[current].data;
+        end = ptr + blocks[current].size;
+    }
+};
+
+// 由 Arena 提供存储的顺序容器，元素必须是可按位复制的简单类型；
+// 扩容时旧数组留在 Arena 中，直到下一次 reset()
+template <class T>
+class ArenaVector {
+public:
+    explicit ArenaVector(Arena &arena) : arena(arena), items(NULL), count(0), capacity(0) {}
+
+    void push_back(const T &item) {
+        if (count == capacity) grow();
+        items[count++] = item;
+    }
+
+    void pop_back() { count--; }
+    void truncate(size_t n) { if (n < count) count = n; }
+    void clear() { count = 0; }
+
+    // 丢弃存储（Arena reset 之后调用）
+    void release() { items = NULL; count = capacity = 0; }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    T &operator[](size_t i) { return items[i]; }
+    const T &operator[](size_t i) const { return items[i]; }
+    T &back() { return items[count - 1]; }
+
+private:
+    Arena &arena;
+    T *items;
+    size_t count;
+    size_t capacity;
+
+    void grow() {
+        size_t new_capacity = capacity == 0 ? 16 : capacity * 2;
+        T *new_items = arena.allocate_array<T>(new_capacity);
+        if (count > 0) std::memcpy(static_cast<void*>(new_items), items, count * sizeof(T));
+        items = new_items;
+        capacity = new_capacity;
+    }
+};
+
+#endif
@@ -0,0 +1,734 @@
+// ast-binary.cc - 二进制 AST 的写出与读入
+//
+// 写出时后序遍历，子结点和列表先于父结点记录；读入时按下标顺序
+// 逐个构造结点，子结点的指针总是已经存在，不需要回填。
+
+#include "ast-binary.h"
+#include "semant.h"
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+// 每种结点的字段含义，每个字符对应一个字段：
+//   '-' 不用        'b' 布尔值
+//   'i' idtable     'n' inttable     's' stringtable
+//   'e' 表达式      'c' 类列表        'f' 特征列表
+//   'p' 形参列表    'a' 表达式列表    'k' case 分支列表
+static const char *const field_specs[AST_KIND_COUNT] = {
+    "c---",   // program: classes
+    "iifs",   // class: name, parent, features, filename
+    "ipie",   // method: name, formals, return_type, body
+    "iie-",   // attr: name, type_decl, init
+    "ii--",   // formal: name, type_decl
+    "iie-",   // branch: name, type_decl, expr
+    "ie--",   // assign: name, expr
+    "eiia",   // static_dispatch: expr, type_name, name, actuals
+    "eia-",   // dispatch: expr, name, actuals
+    "eee-",   // cond: pred, then_exp, else_exp
+    "ee--",   // loop: pred, body
+    "ek--",   // typcase: expr, cases
+    "a---",   // block: body
+    "iiee",   // let: identifier, type_decl, init, body
+    "ee--",   // plus
+    "ee--",   // minus
+    "ee--",   // times
+    "ee--",   // divide
+    "e---",   // neg
+    "ee--",   // lt
+    "ee--",   // eq
+    "ee--",   // leq
+    "e---",   // comp
+    "n---",   // int_const: token
+    "b---",   // bool_const: val
+    "s---",   // string_const: token
+    "i---",   // new: type_name
+    "e---",   // isvoid
+    "----",   // no_expr
+    "i---",   // object: name
+};
+
+static bool is_expression_kind(uint32_t kind) {
+    return kind >= AST_ASSIGN && kind < AST_KIND_COUNT;
+}
+
+////////////////////////////////////////////////////////////////////
+//
+// 写出
+//
+////////////////////////////////////////////////////////////////////
+
+class BinaryAstWriter {
+public:
+    void write(Program program, std::ostream &out) {
+        program_class *root = static_cast<program_class *>(program);
+        uint32_t classes = list(root->get_classes(), [this](Class_ c) { return class_node(c); });
+        uint32_t index = node(AST_PROGRAM, program, classes);
+
+        BinaryAstHeader header;
+        memcpy(header.magic, BINARY_AST_MAGIC, sizeof(header.magic));
+        header.version = BINARY_AST_VERSION;
+        header.string_count = strings.size();
+        header.node_count = nodes.size();
+        header.list_words = pool.size();
+        header.string_bytes = bytes.size();
+        header.root = index;
+
+        out.write((const char *) &header, sizeof(header));
+        out.write((const char *) strings.data(), strings.size() * sizeof(BinaryAstString));
+        out.write((const char *) nodes.data(), nodes.size() * sizeof(BinaryAstNode));
+        out.write((const char *) pool.data(), pool.size() * sizeof(uint32_t));
+        out.write(bytes.data(), bytes.size());
+    }
+
+private:
+    std::vector<BinaryAstString> strings;
+    std::string bytes;
+    std::unordered_map<Symbol, uint32_t> string_ids;   // 三个表的 Entry 互不相同
+    std::vector<BinaryAstNode> nodes;
+    std::vector<uint32_t> pool;
+    std::vector<uint32_t> items;                        // 已写出、尚未归入父结点的子结点和列表元素
+
+    uint32_t string(Symbol s, BinaryAstTable table) {
+        if (s == NULL) return BINARY_AST_NONE;
+        auto it = string_ids.find(s);
+        if (it != string_ids.end()) return it->second;
+        BinaryAstString entry = { (uint32_t) bytes.size(), (uint32_t) s->get_len(), (uint32_t) table };
+        bytes.append(s->get_string(), s->get_len());
+        bytes += '\0';
+        uint32_t id = strings.size();
+        strings.push_back(entry);
+        string_ids[s] = id;
+        return id;
+    }
+
+    uint32_t id(Symbol s) { return string(s, AST_TABLE_ID); }
+
+    uint32_t node(BinaryAstKind kind, tree_node *n, uint32_t f0 = BINARY_AST_NONE,
+                  uint32_t f1 = BINARY_AST_NONE, uint32_t f2 = BINARY_AST_NONE,
+                  uint32_t f3 = BINARY_AST_NONE, uint32_t type = BINARY_AST_NONE) {
+        BinaryAstNode record = { (uint16_t) kind, 0, (uint32_t) n->get_line_number(), type,
+                                 { f0, f1, f2, f3 } };
+        nodes.push_back(record);
+        return nodes.size() - 1;
+    }
+
+    // 先写出所有元素，再把 [个数, 下标...] 追加到列表池
+    template <class Elem, class F>
+    uint32_t list(list_node<Elem> *l, F element) {
+        size_t mark = items.size();
+        for (int i = l->first(); l->more(i); i = l->next(i)) {
+            items.push_back(element(l->nth(i)));
+        }
+        uint32_t ref = pool.size();
+        pool.push_back(items.size() - mark);
+        pool.insert(pool.end(), items.begin() + mark, items.end());
+        items.resize(mark);
+        return ref;
+    }
+
+    uint32_t class_node(Class_ c) {
+        uint32_t features = list(c->get_features(), [this](Feature f) { return feature(f); });
+        return node(AST_CLASS, c, id(c->get_name()), id(c->get_parent()), features,
+                    string(c->get_filename(), AST_TABLE_STRING));
+    }
+
+    uint32_t feature(Feature f) {
+        if (method_class *m = as_method(f)) {
+            uint32_t formals = list(m->get_formals(), [this](Formal formal) {
+                return node(AST_FORMAL, formal, id(formal->get_name()), id(formal->get_type()));
+            });
+            uint32_t body = expression(m->get_body());
+            return node(AST_METHOD, m, id(m->get_name()), formals, id(m->get_return_type()), body);
+        }
+        attr_class *a = as_attr(f);
+        uint32_t init = expression(a->get_init());
+        return node(AST_ATTR, a, id(a->get_name()), id(a->get_type()), init);
+    }
+
+    // 表达式写出用显式栈代替递归：每个尚未写出的表达式占一帧，子结点写出后
+    // 下标压入 items，本帧的子结点全部写出后从 items 取回字段并写出自身。
+    // 写出顺序与逐层递归完全相同，无论嵌套多深，原生栈的使用都是常数
+    struct WriteFrame {
+        Expression expr;
+        ExprKind kind;
+        int step;               // 已完成的步骤
+        int index;              // 列表（块、实参、case 分支）中下一个元素的位置
+        size_t mark;            // 本帧子结点下标在 items 中的起点
+    };
+    std::vector<WriteFrame> frames;
+
+    void push_frame(Expression e) {
+        WriteFrame frame = { e, expr_kind(e), 0, 0, items.size() };
+        frames.push_back(frame);
+    }
+
+    // 把 items 末尾 count 个下标作为一个列表追加到列表池，换成列表的引用
+    void close_list(uint32_t count) {
+        uint32_t ref = pool.size();
+        pool.push_back(count);
+        pool.insert(pool.end(), items.end() - count, items.end());
+        items.resize(items.size() - count);
+        items.push_back(ref);
+    }
+
+    // 依次返回列表的元素，全部写出后关闭列表并进入下一步
+    Expression list_element(WriteFrame &frame, Expressions l) {
+        if (l->more(frame.index)) return l->nth(frame.index++);
+        close_list(frame.index);
+        frame.step++;
+        return NULL;
+    }
+
+    // 本帧下一个要写出的子表达式；为 NULL 时子结点已全部写出
+    Expression next_child(WriteFrame &frame) {
+        Expression e = frame.expr;
+        switch (frame.kind) {
+        case EXPR_ASSIGN:
+            return frame.step++ == 0 ? static_cast<assign_class *>(e)->get_expr() : NULL;
+        case EXPR_DISPATCH:
+            if (frame.step == 0) {
+                frame.step = 1;
+                return static_cast<dispatch_class *>(e)->get_expr();
+            }
+            return frame.step == 1 ? list_element(frame, static_cast<dispatch_class *>(e)->get_actuals()) : NULL;
+        case EXPR_STATIC_DISPATCH:
+            if (frame.step == 0) {
+                frame.step = 1;
+                return static_cast<static_dispatch_class *>(e)->get_expr();
+            }
+            return frame.step == 1 ? list_element(frame, static_cast<static_dispatch_class *>(e)->get_actuals()) : NULL;
+        case EXPR_COND: {
+            cond_class *x = static_cast<cond_class *>(e);
+            switch (frame.step++) {
+            case 0: return x->get_pred();
+            case 1: return x->get_then_exp();
+            case 2: return x->get_else_exp();
+            default: return NULL;
+            }
+        }
+        case EXPR_LOOP: {
+            loop_class *x = static_cast<loop_class *>(e);
+            switch (frame.step++) {
+            case 0: return x->get_pred();
+            case 1: return x->get_body();
+            default: return NULL;
+            }
+        }
+        case EXPR_BLOCK:
+            return frame.step == 0 ? list_element(frame, static_cast<block_class *>(e)->get_body()) : NULL;
+        case EXPR_LET: {
+            let_class *x = static_cast<let_class *>(e);
+            switch (frame.step++) {
+            case 0: return x->get_init();
+            case 1: return x->get_body();
+            default: return NULL;
+            }
+        }
+        case EXPR_TYPCASE: {
+            // 步骤：0 接收者，1 下一个分支的表达式，2 写出刚完成的分支结点
+            typcase_class *x = static_cast<typcase_class *>(e);
+            Cases cases = x->get_cases();
+            if (frame.step == 0) {
+                frame.step = 1;
+                return x->get_expr();
+            }
+            if (frame.step == 2) {
+                branch_class *b = static_cast<branch_class *>(cases->nth(frame.index++));
+                uint32_t body = items.back();
+                items.back() = node(AST_BRANCH, b, id(b->get_name()), id(b->get_type_decl()), body);
+                frame.step = 1;
+            }
+            if (frame.step == 1) {
+                if (cases->more(frame.index)) {
+                    frame.step = 2;
+                    return static_cast<branch_class *>(cases->nth(frame.index))->get_expr();
+                }
+                close_list(frame.index);
+                frame.step = 3;
+            }
+            return NULL;
+        }
+        case EXPR_ISVOID:
+            return frame.step++ == 0 ? static_cast<isvoid_class *>(e)->get_expr() : NULL;
+        case EXPR_COMP:
+            return frame.step++ == 0 ? static_cast<comp_class *>(e)->get_expr() : NULL;
+        case EXPR_NEG:
+            return frame.step++ == 0 ? static_cast<neg_class *>(e)->get_expr() : NULL;
+        case EXPR_PLUS:
+        case EXPR_MINUS:
+        case EXPR_TIMES:
+        case EXPR_DIVIDE:
+        case EXPR_LT:
+        case EXPR_LEQ:
+        case EXPR_EQ: {
+            if (frame.step >= 2) return NULL;
+            Expression left, right;
+            binary_operands(frame.kind, e, left, right);
+            return frame.step++ == 0 ? left : right;
+        }
+        default:
+            return NULL;
+        }
+    }
+
+    // 子结点已全部写出，c 为它们（或列表）的下标，按写出顺序排列
+    uint32_t finish(const WriteFrame &frame, const uint32_t *c) {
+        Expression e = frame.expr;
+        switch (frame.kind) {
+        case EXPR_INT_CONST:
+            return typed(AST_INT_CONST, e,
+                         string(static_cast<int_const_class *>(e)->get_token(), AST_TABLE_INT));
+        case EXPR_BOOL_CONST:
+            return typed(AST_BOOL_CONST, e, static_cast<bool_const_class *>(e)->get_val() ? 1 : 0);
+        case EXPR_STRING_CONST:
+            return typed(AST_STRING_CONST, e,
+                         string(static_cast<string_const_class *>(e)->get_token(), AST_TABLE_STRING));
+        case EXPR_NO_EXPR:
+            return typed(AST_NO_EXPR, e);
+        case EXPR_VAR:
+            return typed(AST_VAR, e, id(static_cast<var_class *>(e)->get_name()));
+        case EXPR_ASSIGN:
+            return typed(AST_ASSIGN, e, id(static_cast<assign_class *>(e)->get_name()), c[0]);
+        case EXPR_DISPATCH:
+            return typed(AST_DISPATCH, e, c[0], id(static_cast<dispatch_class *>(e)->get_name()), c[1]);
+        case EXPR_STATIC_DISPATCH: {
+            static_dispatch_class *x = static_cast<static_dispatch_class *>(e);
+            return typed(AST_STATIC_DISPATCH, e, c[0], id(x->get_type_name()), id(x->get_name()), c[1]);
+        }
+        case EXPR_COND:
+            return typed(AST_COND, e, c[0], c[1], c[2]);
+        case EXPR_LOOP:
+            return typed(AST_LOOP, e, c[0], c[1]);
+        case EXPR_BLOCK:
+            return typed(AST_BLOCK, e, c[0]);
+        case EXPR_LET: {
+            let_class *x = static_cast<let_class *>(e);
+            return typed(AST_LET, e, id(x->get_identifier()), id(x->get_type_decl()), c[0], c[1]);
+        }
+        case EXPR_TYPCASE:
+            return typed(AST_TYPCASE, e, c[0], c[1]);
+        case EXPR_NEW:
+            return typed(AST_NEW, e, id(static_cast<new__class *>(e)->get_type_name()));
+        case EXPR_ISVOID:
+            return typed(AST_ISVOID, e, c[0]);
+        case EXPR_PLUS:
+            return typed(AST_PLUS, e, c[0], c[1]);
+        case EXPR_MINUS:
+            return typed(AST_MINUS, e, c[0], c[1]);
+        case EXPR_TIMES:
+            return typed(AST_TIMES, e, c[0], c[1]);
+        case EXPR_DIVIDE:
+            return typed(AST_DIVIDE, e, c[0], c[1]);
+        case EXPR_LT:
+            return typed(AST_LT, e, c[0], c[1]);
+        case EXPR_LEQ:
+            return typed(AST_LEQ, e, c[0], c[1]);
+        case EXPR_EQ:
+            return typed(AST_EQ, e, c[0], c[1]);
+        case EXPR_COMP:
+            return typed(AST_COMP, e, c[0]);
+        case EXPR_NEG:
+            return typed(AST_NEG, e, c[0]);
+        default:
+            return typed(AST_NO_EXPR, e);
+        }
+    }
+
+    uint32_t typed(BinaryAstKind kind, Expression e, uint32_t f0 = BINARY_AST_NONE,
+                   uint32_t f1 = BINARY_AST_NONE, uint32_t f2 = BINARY_AST_NONE,
+                   uint32_t f3 = BINARY_AST_NONE) {
+        return node(kind, e, f0, f1, f2, f3, id(e->get_type()));
+    }
+
+    uint32_t expression(Expression root) {
+        size_t base = frames.size();
+        push_frame(root);
+        while (frames.size() > base) {
+            WriteFrame &frame = frames.back();
+            Expression child = next_child(frame);
+            if (child != NULL) {
+                push_frame(child);
+                continue;
+            }
+            size_t mark = frame.mark;
+            uint32_t index = finish(frame, items.data() + mark);
+            frames.pop_back();
+            items.resize(mark);
+            items.push_back(index);
+        }
+        uint32_t index = items.back();
+        items.pop_back();
+        return index;
+    }
+};
+
+void write_binary_ast(Program program, std::ostream &out) {
+    BinaryAstWriter writer;
+    writer.write(program, out);
+}
+
+////////////////////////////////////////////////////////////////////
+//
+// 读入
+//
+////////////////////////////////////////////////////////////////////
+
+// 每个对象按最大对齐取整，第一遍算总大小和第二遍构造用同一规则
+static inline size_t object_size(size_t size) {
+    const size_t align = alignof(std::max_align_t);
+    return (size + align - 1) & ~(align - 1);
+}
+
+template <class Elem>
+static size_t list_size(uint32_t count) {
+    if (count == 0) return object_size(sizeof(nil_node<Elem>));
+    return count * object_size(sizeof(single_list_node<Elem>)) +
+           (count - 1) * object_size(sizeof(append_node<Elem>));
+}
+
+static size_t node_size(uint32_t kind) {
+    switch (kind) {
+    case AST_PROGRAM:         return object_size(sizeof(program_class));
+    case AST_CLASS:           return object_size(sizeof(class__class));
+    case AST_METHOD:          return object_size(sizeof(method_class));
+    case AST_ATTR:            return object_size(sizeof(attr_class));
+    case AST_FORMAL:          return object_size(sizeof(formal_class));
+    case AST_BRANCH:          return object_size(sizeof(branch_class));
+    case AST_ASSIGN:          return object_size(sizeof(assign_class));
+    case AST_STATIC_DISPATCH: return object_size(sizeof(static_dispatch_class));
+    case AST_DISPATCH:        return object_size(sizeof(dispatch_class));
+    case AST_COND:            return object_size(sizeof(cond_class));
+    case AST_LOOP:            return object_size(sizeof(loop_class));
+    case AST_TYPCASE:         return object_size(sizeof(typcase_class));
+    case AST_BLOCK:           return object_size(sizeof(block_class));
+    case AST_LET:             return object_size(sizeof(let_class));
+    case AST_PLUS:            return object_size(sizeof(plus_class));
+    case AST_MINUS:           return object_size(sizeof(minus_class));
+    case AST_TIMES:           return object_size(sizeof(times_class));
+    case AST_DIVIDE:          return object_size(sizeof(divide_class));
+    case AST_NEG:             return object_size(sizeof(neg_class));
+    case AST_LT:              return object_size(sizeof(lt_class));
+    case AST_EQ:              return object_size(sizeof(eq_class));
+    case AST_LEQ:             return object_size(sizeof(leq_class));
+    case AST_COMP:            return object_size(sizeof(comp_class));
+    case AST_INT_CONST:       return object_size(sizeof(int_const_class));
+    case AST_BOOL_CONST:      return object_size(sizeof(bool_const_class));
+    case AST_STRING_CONST:    return object_size(sizeof(string_const_class));
+    case AST_NEW:             return object_size(sizeof(new__class));
+    case AST_ISVOID:          return object_size(sizeof(isvoid_class));
+    case AST_NO_EXPR:         return object_size(sizeof(no_expr_class));
+    default:                  return object_size(sizeof(var_class));
+    }
+}
+
+class BinaryAstReader {
+public:
+    BinaryAstReader(const char *data, size_t size, std::string &error)
+        : data(data), size(size), error(error) {}
+
+    Program read() {
+        if (!parse_sections() || !intern_strings() || !validate()) return NULL;
+
+        // 第一遍：算出所有结点和列表结点的总大小，一次分配
+        size_t total = 0;
+        for (uint32_t i = 0; i < header.node_count; i++) {
+            const BinaryAstNode &n = nodes[i];
+            total += node_size(n.kind);
+            for (int f = 0; f < 4; f++) {
+                switch (field_specs[n.kind][f]) {
+                case 'c': total += list_size<Class_>(pool_count(n, f)); break;
+                case 'f': total += list_size<Feature>(pool_count(n, f)); break;
+                case 'p': total += list_size<Formal>(pool_count(n, f)); break;
+                case 'a': total += list_size<Expression>(pool_count(n, f)); break;
+                case 'k': total += list_size<Case>(pool_count(n, f)); break;
+                }
+            }
+        }
+        memory = (char *) malloc(total > 0 ? total : 1);
+        if (memory == NULL) {
+            fail("out of memory");
+            return NULL;
+        }
+        // program 结点放在整块内存的开头，free_binary_ast 据此释放整棵树
+        cursor = memory + node_size(AST_PROGRAM);
+
+        // 第二遍：按下标顺序构造，子结点总是已经建好
+        built.resize(header.node_count);
+        int saved_lineno = node_lineno;
+        for (uint32_t i = 0; i < header.node_count; i++) {
+            built[i] = construct(nodes[i]);
+        }
+        node_lineno = saved_lineno;
+        return static_cast<Program>(built[header.root]);
+    }
+
+private:
+    const char *data;
+    size_t size;
+    std::string &error;
+
+    BinaryAstHeader header;
+    const BinaryAstString *strings;
+    const BinaryAstNode *nodes;
+    const uint32_t *pool;
+    const char *bytes;
+    std::vector<Symbol> symbols;
+    std::vector<tree_node *> built;
+    char *memory;
+    char *cursor;
+
+    bool fail(const std::string &message) {
+        error = message;
+        return false;
+    }
+
+    bool parse_sections() {
+        if (size < sizeof(BinaryAstHeader)) return fail("file too short");
+        memcpy(&header, data, sizeof(header));
+        if (memcmp(header.magic, BINARY_AST_MAGIC, sizeof(header.magic)) != 0) {
+            return fail("not a binary AST");
+        }
+        if (header.version != BINARY_AST_VERSION) {
+            return fail("unsupported version " + std::to_string(header.version));
+        }
+        uint64_t expected = sizeof(BinaryAstHeader) +
+                            (uint64_t) header.string_count * sizeof(BinaryAstString) +
+                            (uint64_t) header.node_count * sizeof(BinaryAstNode) +
+                            (uint64_t) header.list_words * sizeof(uint32_t) +
+                            header.string_bytes;
+        if (expected != size) return fail("section sizes do not match file size");
+        if (header.root >= header.node_count || header.root != header.node_count - 1) {
+            return fail("bad root index");
+        }
+
+        const char *p = data + sizeof(BinaryAstHeader);
+        strings = (const BinaryAstString *) p;
+        p += header.string_count * sizeof(BinaryAstString);
+        nodes = (const BinaryAstNode *) p;
+        p += (size_t) header.node_count * sizeof(BinaryAstNode);
+        pool = (const uint32_t *) p;
+        p += (size_t) header.list_words * sizeof(uint32_t);
+        bytes = p;
+        return true;
+    }
+
+    bool intern_strings() {
+        symbols.resize(header.string_count);
+        for (uint32_t i = 0; i < header.string_count; i++) {
+            const BinaryAstString &s = strings[i];
+            if ((uint64_t) s.offset + s.length >= header.string_bytes || bytes[s.offset + s.length] != '\0') {
+                return fail("bad string " + std::to_string(i));
+            }
+            char *text = const_cast<char *>(bytes + s.offset);
+            switch (s.table) {
+            case AST_TABLE_ID:     symbols[i] = idtable.add_string(text, s.length); break;
+            case AST_TABLE_INT:    symbols[i] = inttable.add_string(text, s.length); break;
+            case AST_TABLE_STRING: symbols[i] = stringtable.add_string(text, s.length); break;
+            default: return fail("bad string table " + std::to_string(s.table));
+            }
+        }
+        return true;
+    }
+
+    // 列表字段的元素个数，只对列表种类的字段调用
+    uint32_t pool_count(const BinaryAstNode &n, int f) const {
+        return n.field[f] < header.list_words ? pool[n.field[f]] : 0;
+    }
+
+    bool valid_string(uint32_t ref, uint32_t table) const {
+        return ref < header.string_count && strings[ref].table == table;
+    }
+
+    bool valid_child(uint32_t ref, uint32_t index, char category) const {
+        if (ref >= index) return false;
+        uint32_t kind = nodes[ref].kind;
+        switch (category) {
+        case 'c': return kind == AST_CLASS;
+        case 'f': return kind == AST_METHOD || kind == AST_ATTR;
+        case 'p': return kind == AST_FORMAL;
+        case 'k': return kind == AST_BRANCH;
+        default:  return is_expression_kind(kind);
+        }
+    }
+
+    // 检查每个字段的引用都在范围内且种类正确，构造时不再检查
+    bool validate() {
+        for (uint32_t i = 0; i < header.node_count; i++) {
+            const BinaryAstNode &n = nodes[i];
+            std::string where = "node " + std::to_string(i);
+            if (n.kind >= AST_KIND_COUNT) return fail(where + ": bad kind");
+            if ((n.kind == AST_PROGRAM) != (i == header.root)) return fail(where + ": misplaced program");
+            if (n.type != BINARY_AST_NONE && !valid_string(n.type, AST_TABLE_ID)) {
+                return fail(where + ": bad type");
+            }
+            for (int f = 0; f < 4; f++) {
+                char spec = field_specs[n.kind][f];
+                uint32_t ref = n.field[f];
+                bool ok = true;
+                switch (spec) {
+                case '-': break;
+                case 'b': ok = ref <= 1; break;
+                case 'i': ok = valid_string(ref, AST_TABLE_ID); break;
+                case 'n': ok = valid_string(ref, AST_TABLE_INT); break;
+                case 's': ok = valid_string(ref, AST_TABLE_STRING); break;
+                case 'e': ok = valid_child(ref, i, 'e'); break;
+                default:
+                    ok = ref < header.list_words && pool[ref] < header.list_words - ref;
+                    for (uint32_t k = 0; ok && k < pool[ref]; k++) {
+                        ok = valid_child(pool[ref + 1 + k], i, spec);
+                    }
+                    break;
+                }
+                if (!ok) return fail(where + ": bad field " + std::to_string(f));
+            }
+        }
+        return true;
+    }
+
+    template <class T, class... Args>
+    T *make(Args... args) {
+        void *p = cursor;
+        cursor += object_size(sizeof(T));
+        return new (p) T(args...);
+    }
+
+    // 自底向上两两合并成平衡的 append 树，不递归；元素顺序不变
+    template <class Elem>
+    list_node<Elem> *balanced(const uint32_t *items, uint32_t count) {
+        std::vector<list_node<Elem> *> &level = levels<Elem>();
+        level.clear();
+        for (uint32_t i = 0; i < count; i++) {
+            level.push_back(make<single_list_node<Elem> >(static_cast<Elem>(built[items[i]])));
+        }
+        while (level.size() > 1) {
+            size_t merged = 0;
+            for (size_t i = 0; i + 1 < level.size(); i += 2) {
+                level[merged++] = make<append_node<Elem> >(level[i], level[i + 1]);
+            }
+            if (level.size() % 2 != 0) level[merged++] = level.back();
+            level.resize(merged);
+        }
+        return level[0];
+    }
+
+    // balanced 的工作区，每种元素一个，跨列表复用
+    template <class Elem>
+    static std::vector<list_node<Elem> *> &levels() {
+        static thread_local std::vector<list_node<Elem> *> level;
+        return level;
+    }
+
+    template <class Elem>
+    list_node<Elem> *list(uint32_t ref) {
+        if (pool[ref] == 0) return make<nil_node<Elem> >();
+        return balanced<Elem>(pool + ref + 1, pool[ref]);
+    }
+
+    Symbol sym(uint32_t ref) const { return symbols[ref]; }
+    Expression expr(uint32_t ref) const { return static_cast<Expression>(built[ref]); }
+
+    tree_node *construct(const BinaryAstNode &n) {
+        node_lineno = n.line;
+        const uint32_t *f = n.field;
+        Expression e = NULL;
+        switch (n.kind) {
+        case AST_PROGRAM:
+            return new (memory) program_class(list<Class_>(f[0]));
+        case AST_CLASS:
+            return make<class__class>(sym(f[0]), sym(f[1]), list<Feature>(f[2]), sym(f[3]));
+        case AST_METHOD:
+            return make<method_class>(sym(f[0]), list<Formal>(f[1]), sym(f[2]), expr(f[3]));
+        case AST_ATTR:
+            return make<attr_class>(sym(f[0]), sym(f[1]), expr(f[2]));
+        case AST_FORMAL:
+            return make<formal_class>(sym(f[0]), sym(f[1]));
+        case AST_BRANCH:
+            return make<branch_class>(sym(f[0]), sym(f[1]), expr(f[2]));
+        case AST_ASSIGN:          e = make<assign_class>(sym(f[0]), expr(f[1])); break;
+        case AST_STATIC_DISPATCH:
+            e = make<static_dispatch_class>(expr(f[0]), sym(f[1]), sym(f[2]), list<Expression>(f[3]));
+            break;
+        case AST_DISPATCH:
+            e = make<dispatch_class>(expr(f[0]), sym(f[1]), list<Expression>(f[2]));
+            break;
+        case AST_COND:            e = make<cond_class>(expr(f[0]), expr(f[1]), expr(f[2])); break;
+        case AST_LOOP:            e = make<loop_class>(expr(f[0]), expr(f[1])); break;
+        case AST_TYPCASE:         e = make<typcase_class>(expr(f[0]), list<Case>(f[1])); break;
+        case AST_BLOCK:           e = make<block_class>(list<Expression>(f[0])); break;
+        case AST_LET:
+            e = make<let_class>(sym(f[0]), sym(f[1]), expr(f[2]), expr(f[3]));
+            break;
+        case AST_PLUS:            e = make<plus_class>(expr(f[0]), expr(f[1])); break;
+        case AST_MINUS:           e = make<minus_class>(expr(f[0]), expr(f[1])); break;
+        case AST_TIMES:           e = make<times_class>(expr(f[0]), expr(f[1])); break;
+        case AST_DIVIDE:          e = make<divide_class>(expr(f[0]), expr(f[1])); break;
+        case AST_NEG:             e = make<neg_class>(expr(f[0])); break;
+        case AST_LT:              e = make<lt_class>(expr(f[0]), expr(f[1])); break;
+        case AST_EQ:              e = make<eq_class>(expr(f[0]), expr(f[1])); break;
+        case AST_LEQ:             e = make<leq_class>(expr(f[0]), expr(f[1])); break;
+        case AST_COMP:            e = make<comp_class>(expr(f[0])); break;
+        case AST_INT_CONST:       e = make<int_const_class>(sym(f[0])); break;
+        case AST_BOOL_CONST:      e = make<bool_const_class>((Boolean) (f[0] != 0)); break;
+        case AST_STRING_CONST:    e = make<string_const_class>(sym(f[0])); break;
+        case AST_NEW:             e = make<new__class>(sym(f[0])); break;
+        case AST_ISVOID:          e = make<isvoid_class>(expr(f[0])); break;
+        case AST_NO_EXPR:         e = make<no_expr_class>(); break;
+        default:                  e = make<var_class>(sym(f[0])); break;
+        }
+        if (n.type != BINARY_AST_NONE) e->set_type(sym(n.type));
+        return e;
+    }
+};
+
+Program read_binary_ast(const char *path, std::string &error) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        error = std::string("cannot open ") + path;
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        error = std::string("cannot read ") + path;
+        return NULL;
+    }
+    size_t size = st.st_size;
+    void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        error = std::string("cannot map ") + path;
+        return NULL;
+    }
+
+    // 字符串已复制进字符串表，结点已建好，读完即可解除映射
+    Program program = read_binary_ast((const char *) data, size, error);
+    munmap(data, size);
+    return program;
+}
+
+Program read_binary_ast(const char *data, size_t size, std::string &error) {
+    BinaryAstReader reader(data, size, error);
+    return reader.read();
+}
+
+// 结点不持有其他资源，不逐个析构
+void free_binary_ast(Program program) {
+    free(program);
+}
+
+bool is_binary_ast(const char *path) {
+    char magic[sizeof(BINARY_AST_MAGIC)];
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) return false;
+    bool binary = fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+                  memcmp(magic, BINARY_AST_MAGIC, sizeof(magic)) == 0;
+    fclose(file);
+    return binary;
+}
@@ -0,0 +1,108 @@
+#ifndef AST_BINARY_H
+#define AST_BINARY_H
+
+#include "cool-tree.h"
+#include <ostream>
+#include <stdint.h>
+#include <string>
+
+// 二进制 AST 格式：parser 的文本输出需要逐个结点词法分析和分配，
+// 大程序上比语义分析本身还慢。二进制格式可以 mmap 后直接建树：
+//
+//   BinaryAstHeader
+//   BinaryAstString[string_count]   字符串表：偏移、长度、所属的表
+//   BinaryAstNode[node_count]       结点数组，子结点总在父结点之前（后序）
+//   uint32_t[list_words]            列表池：每个列表为 [个数, 结点下标...]
+//   char[string_bytes]              字符串内容，每个以 '\0' 结尾
+//
+// 各段都按 4 字节对齐，整数按本机字节序存放（只在同一台机器上传递）。
+// 结点的字段按种类解释，见 ast-binary.cc 中的 write_node。
+
+const char BINARY_AST_MAGIC[8] = { 'C', 'O', 'O', 'L', 'A', 'S', 'T', '\0' };
+const uint32_t BINARY_AST_VERSION = 1;
+const uint32_t BINARY_AST_NONE = 0xFFFFFFFFu;   // 空的字符串或结点引用
+
+struct BinaryAstHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t string_count;
+    uint32_t node_count;
+    uint32_t list_words;
+    uint32_t string_bytes;
+    uint32_t root;            // program 结点的下标
+};
+
+// 字符串所属的表
+enum BinaryAstTable {
+    AST_TABLE_ID,
+    AST_TABLE_INT,
+    AST_TABLE_STRING,
+};
+
+struct BinaryAstString {
+    uint32_t offset;          // 在字符串内容段中的偏移
+    uint32_t length;
+    uint32_t table;           // BinaryAstTable
+};
+
+enum BinaryAstKind {
+    AST_PROGRAM,
+    AST_CLASS,
+    AST_METHOD,
+    AST_ATTR,
+    AST_FORMAL,
+    AST_BRANCH,
+    AST_ASSIGN,
+    AST_STATIC_DISPATCH,
+    AST_DISPATCH,
+    AST_COND,
+    AST_LOOP,
+    AST_TYPCASE,
+    AST_BLOCK,
+    AST_LET,
+    AST_PLUS,
+    AST_MINUS,
+    AST_TIMES,
+    AST_DIVIDE,
+    AST_NEG,
+    AST_LT,
+    AST_EQ,
+    AST_LEQ,
+    AST_COMP,
+    AST_INT_CONST,
+    AST_BOOL_CONST,
+    AST_STRING_CONST,
+    AST_NEW,
+    AST_ISVOID,
+    AST_NO_EXPR,
+    AST_VAR,
+    AST_KIND_COUNT
+};
+
+struct BinaryAstNode {
+    uint16_t kind;            // BinaryAstKind
+    uint16_t reserved;
+    uint32_t line;
+    uint32_t type;            // 表达式的类型（字符串下标），未标注时为 BINARY_AST_NONE
+    uint32_t field[4];        // 字符串下标、结点下标或列表池下标
+};
+
+// 把程序写成二进制格式（parser 或 semant 都可以调用；已标注的类型一并写出）
+void write_binary_ast(Program program, std::ostream &out);
+
+// mmap 读入二进制 AST，所有结点（含列表结点）在一次分配中建成 cool-tree。
+// 列表建成平衡的 append 树，len()/nth() 的递归深度随长度对数增长。
+// 失败时返回 NULL，原因写入 error
+Program read_binary_ast(const char *path, std::string &error);
+
+// 同上，从内存中的二进制 AST 读入；返回后 data 即可释放
+Program read_binary_ast(const char *data, size_t size, std::string &error);
+
+// 释放 read_binary_ast 建的整棵树（含其中所有结点和列表结点）。
+// 不释放时与 parser 建的树生命期相同
+void free_binary_ast(Program program);
+
+// 文件是否以二进制 AST 的魔数开头
+bool is_binary_ast(const char *path);
+
+#endif
@@ -0,0 +1,65 @@
+// ast-convert.cc - 文本 AST 与二进制 AST 之间的转换
+//
+// 用法: ast-convert [输入] [输出]
+//   输入为 parser 的文本输出时写出二进制 AST（见 ast-binary.h），
+//   输入为二进制 AST 时写回文本格式（dump_with_types，可用于核对）。
+//   输入省略或为 - 时读标准输入（只支持文本），省略输出时写标准输出。
+//
+// 与 semant 链接相同的目标文件（含 ast-lex、ast-parse、ast-binary），
+// 以 ast-convert.o 代替 semant-phase.o；semant.o 提供结点种类表 expr_kind。
+
+#include "ast-binary.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+// AST 读取器（ast-lex.cc / ast-parse.cc）
+extern FILE *ast_file;
+extern int ast_yyparse(void);
+extern Program ast_root;
+
+int main(int argc, char *argv[]) {
+    if (argc > 3) {
+        std::cerr << "usage: " << argv[0] << " [input] [output]" << std::endl;
+        return 1;
+    }
+    const char *input = argc > 1 && strcmp(argv[1], "-") != 0 ? argv[1] : NULL;
+    const char *output = argc > 2 ? argv[2] : NULL;
+
+    std::ofstream file;
+    if (output != NULL) {
+        file.open(output, std::ios::binary);
+        if (!file) {
+            std::cerr << argv[0] << ": cannot open " << output << std::endl;
+            return 1;
+        }
+    }
+    std::ostream &out = output != NULL ? file : std::cout;
+
+    if (input != NULL && is_binary_ast(input)) {
+        std::string error;
+        Program root = read_binary_ast(input, error);
+        if (root == NULL) {
+            std::cerr << argv[0] << ": " << input << ": " << error << std::endl;
+            return 1;
+        }
+        root->dump_with_types(out, 0);
+        return out ? 0 : 1;
+    }
+
+    ast_file = input != NULL ? fopen(input, "r") : stdin;
+    if (ast_file == NULL) {
+        std::cerr << argv[0] << ": cannot open " << input << std::endl;
+        return 1;
+    }
+    ast_root = NULL;
+    if (ast_yyparse() != 0 || ast_root == NULL) {
+        std::cerr << argv[0] << ": malformed AST" << std::endl;
+        return 1;
+    }
+    write_binary_ast(ast_root, out);
+    out.flush();
+    return out ? 0 : 1;
+}
@@ -0,0 +1,38 @@
+(* Attrs.cl - 继承的属性、属性初始化表达式和参数遮蔽属性 *)
+
+class Main inherits IO {
+   main(): Object {
+      let c: Counter <- new Counter in
+         {
+            c.add(3).add(4);
+            out_int(c.total());
+            out_string("\n");
+         }
+   };
+};
+
+class Base {
+   step: Int <- 1;
+   scale: Int <- step * 10;
+   label: String <- "base";
+
+   total(): Int { step + scale };
+};
+
+class Counter inherits Base {
+   count: Int <- step + 1;
+   last: Base <- self;
+
+   add(x: Int): SELF_TYPE {
+      {
+         count <- count + x * scale;
+         step <- x;
+         self;
+      }
+   };
+
+   (* 参数 step 遮蔽同名属性 *)
+   shift(step: Bool): Int {
+      if step then count else scale fi
+   };
+};
@@ -0,0 +1,60 @@
+#!/bin/bash
+
+# COOL Semantic Analyzer Benchmark Script
+# Scales complex.cl up to a large synthetic program and reports nodes/sec
+# Usage: ./bench_script.sh [target_lines] [semant_binary ...]
+#   e.g. ./bench_script.sh 100000 ./mysemant_before ./mysemant
+
+TARGET_LINES=${1:-100000}
+shift
+BINARIES=("$@")
+if [ ${#BINARIES[@]} -eq 0 ]; then
+    BINARIES=("./mysemant")
+fi
+RUNS=3
+
+for tool in ./lexer ./parser "${BINARIES[@]}"; do
+    if [ ! -f "$tool" ]; then
+        echo "Error: $tool not found. Please compile first with 'make semant'"
+        exit 1
+    fi
+done
+
+mkdir -p bench_results
+SCALED="bench_results/scaled_complex.cl"
+AST="bench_results/scaled_complex.ast"
+
+# 每个副本把 complex.cl 中的类名加上编号后缀，Main 只保留第一份
+CLASS_NAMES=$(grep -o "^class [A-Za-z_]*" complex.cl | awk '{print $2}')
+SRC_LINES=$(wc -l < complex.cl)
+COPIES=$(( (TARGET_LINES + SRC_LINES - 1) / SRC_LINES ))
+
+echo "Generating $SCALED ($COPIES copies of complex.cl)..."
+cp complex.cl "$SCALED"
+for ((i = 1; i < COPIES; i++)); do
+    SED_ARGS=()
+    for name in $CLASS_NAMES; do
+        SED_ARGS+=(-e "s/\\b$name\\b/${name}_$i/g")
+    done
+    sed "${SED_ARGS[@]}" complex.cl >> "$SCALED"
+done
+
+./lexer "$SCALED" 2>/dev/null | ./parser "$SCALED" > "$AST" 2>/dev/null
+LINES=$(wc -l < "$SCALED")
+# 解析器输出中每个节点占一行 "_节点名"
+NODES=$(grep -c "^ *_[a-z]" "$AST")
+echo "Lines: $LINES  AST nodes: $NODES"
+
+for binary in "${BINARIES[@]}"; do
+    BEST_NS=0
+    for ((r = 0; r < RUNS; r++)); do
+        START_NS=$(date +%s%N)
+        "$binary" < "$AST" > /dev/null 2>&1
+        END_NS=$(date +%s%N)
+        ELAPSED=$((END_NS - START_NS))
+        if [ $BEST_NS -eq 0 ] || [ $ELAPSED -lt $BEST_NS ]; then
+            BEST_NS=$ELAPSED
+        fi
+    done
+    echo "$binary: $((BEST_NS / 1000000)) ms, $((NODES * 1000000000 / BEST_NS)) nodes/sec (best of $RUNS)"
+done
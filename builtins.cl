@@ -0,0 +1,29 @@
+(* Builtins.cl - 基本类的全部方法：Object、IO、String 的签名、SELF_TYPE 返回值和重写 *)
+
+class Main inherits IO {
+   main(): Object {
+      let s: String <- "hello",
+          n: Int,
+          c: Counter <- new Counter
+      in
+         {
+            out_string(s.concat(" world").substr(0, 5)).out_int(s.length()).out_string("\n");
+            out_string(c.type_name()).out_string(c.copy().type_name());
+            c <- c.copy().tick();
+            out_int(c.count());
+            n <- in_int();
+            s <- in_string();
+            if n < 0 then abort() else self fi;
+            (new IO).out_string(type_name()).copy().out_int(n);
+         }
+   };
+};
+
+class Counter {
+   k: Int;
+
+   tick(): SELF_TYPE { { k <- k + 1; self; } };
+   count(): Int { k };
+   type_name(): String { "Counter" };
+   copy(): SELF_TYPE { self };
+};
@@ -0,0 +1,7 @@
+(* Caselub.cl - case 的类型：只有一个分支时就是该分支的类型，即使类型未定义 *)
+
+class Main {
+   main(): Int {
+      let y : Int <- case 0 of x : Undef => x; esac in y    (* case 的类型为 Undef 而不是 Object *)
+   };
+};
@@ -0,0 +1,31 @@
+(* Chain.cl - 40层SELF_TYPE方法链，检查接收者只被类型检查一次 *)
+
+class Main inherits IO {
+   main(): Object {{
+      {
+         let b: Builder <- new Builder in
+            out_int(
+               b.push(1).push(2).push(3).push(4).push(5).push(6).push(7)
+                .push(8).push(9).push(10).push(11).push(12).push(13).push(14)
+                .push(15).push(16).push(17).push(18).push(19).push(20)
+                .push(21).push(22).push(23).push(24).push(25).push(26)
+                .push(27).push(28).push(29).push(30).push(31).push(32)
+                .push(33).push(34).push(35).push(36).push(37).push(38)
+                .push(39).push(40).size());
+         0;
+      }
+   }};
+};
+
+class Builder inherits IO {
+   count: Int <- 0;
+
+   push(x: Int): SELF_TYPE {
+      {
+         count <- count + x;
+         self;
+      }
+   };
+
+   size(): Int { count };
+};
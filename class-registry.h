@@ -0,0 +1,82 @@
+#ifndef CLASS_REGISTRY_H
+#define CLASS_REGISTRY_H
+
+#include "cool-tree.h"
+#include <cstddef>
+#include <vector>
+
+// 类注册表：类名 -> 稠密类编号（按注册顺序从 0 开始）。
+// Symbol 是字符串表中唯一的指针，直接对指针取哈希；
+// 使用线性探测的开放寻址表，装载率不超过 1/2
+class ClassRegistry {
+public:
+    ClassRegistry() : slots(64), mask(63) {}
+
+    // 找不到返回 -1
+    int find(Symbol name) const {
+        for (size_t i = hash(name) & mask; ; i = (i + 1) & mask) {
+            if (slots[i].name == name) return slots[i].id;
+            if (slots[i].name == NULL) return -1;
+        }
+    }
+
+    // 注册新类并返回其编号；同名类已存在时返回 -1
+    int add(Symbol name, Class_ c) {
+        if ((nodes.size() + 1) * 2 > slots.size()) grow();
+        size_t i = hash(name) & mask;
+        while (slots[i].name != NULL) {
+            if (slots[i].name == name) return -1;
+            i = (i + 1) & mask;
+        }
+        slots[i].name = name;
+        slots[i].id = nodes.size();
+        nodes.push_back(c);
+        return slots[i].id;
+    }
+
+    Class_ get(int id) const { return nodes[id]; }
+    int size() const { return nodes.size(); }
+
+    // 只保留编号小于 n 的类（批处理时保留基本类），已分配的内存不释放
+    void truncate(int n) {
+        if (n >= (int) nodes.size()) return;
+        nodes.resize(n);
+        size_t capacity = 64;
+        while (nodes.size() * 2 > capacity) capacity *= 2;
+        rehash(capacity);
+    }
+
+private:
+    struct Slot {
+        Symbol name = NULL;
+        int id = -1;
+    };
+
+    std::vector<Slot> slots;
+    std::vector<Class_> nodes;
+    size_t mask;
+
+    static size_t hash(Symbol name) {
+        size_t h = reinterpret_cast<size_t>(name);
+        h ^= h >> 17;
+        h *= 0x9E3779B97F4A7C15ULL;
+        return h ^ (h >> 29);
+    }
+
+    void grow() {
+        rehash(slots.size() * 2);
+    }
+
+    void rehash(size_t capacity) {
+        slots.assign(capacity, Slot());
+        mask = capacity - 1;
+        for (size_t id = 0; id < nodes.size(); id++) {
+            size_t i = hash(nodes[id]->get_name()) & mask;
+            while (slots[i].name != NULL) i = (i + 1) & mask;
+            slots[i].name = nodes[id]->get_name();
+            slots[i].id = id;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,302 @@
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+#include "cool-tree.h"
+#include <cstddef>
+#include <cstring>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// 语义错误收集器：semant_error() 返回的流把一行消息连同位置、类名和种类
+// 记录到 DiagnosticBuffer 中，不直接写 cool::cerr；程序检查完后一次性输出
+
+// 错误的输出形式，决定文本格式下的前缀
+enum DiagnosticForm {
+    DIAG_PLAIN,      // ERROR: <消息>
+    DIAG_CLASS,      // ERROR: In class <类名>: <消息>
+    DIAG_LOCATION,   // ERROR: <文件>:<行号>: <消息>
+};
+
+// 把字符串按 JSON 转义后连同引号追加到 out；length 为 -1 时以 '\0' 结尾
+inline void json_string(std::string &out, const char *s, long length = -1) {
+    out += '"';
+    for (long i = 0; length < 0 ? s[i] != '\0' : i < length; i++) {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c == '\n') {
+            out += "\\n";
+        } else if (c == '\t') {
+            out += "\\t";
+        } else if (c < 0x20) {
+            static const char hex[] = "0123456789abcdef";
+            out += "\\u00";
+            out += hex[c >> 4];
+            out += hex[c & 15];
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+// 一条错误；消息文本存放在所属 DiagnosticBuffer 的文本池中
+struct Diagnostic {
+    DiagnosticForm form;
+    const char *filename;   // 可能为 NULL
+    int line;
+    Symbol class_name;      // 出错时正在检查的类，可能为 NULL
+    const char *kind;       // 错误种类（class、inheritance、feature、type 等）
+    size_t offset;          // 消息在文本池中的位置
+    size_t length;
+    bool hidden;            // 超过每类上限，只计数不输出
+};
+
+// 附在错误之后的说明（如增量检查跳过的类数），不计入错误数
+struct DiagnosticNote {
+    const char *kind;       // 说明种类（incremental、reachable）
+    std::string message;
+};
+
+class DiagnosticBuffer {
+public:
+    // max_per_class 为每个类最多保留的错误数，0 表示不限
+    explicit DiagnosticBuffer(int max_per_class = 0) : max_per_class(max_per_class) {
+        items.reserve(64);
+        text.reserve(4096);
+    }
+
+    void set_max_per_class(int n) { max_per_class = n; }
+
+    // 记录一条错误。与已有错误完全相同时丢弃并返回 false；
+    // 超过每类上限的错误照常记录和去重，但不输出
+    bool add(DiagnosticForm form, const char *filename, int line, Symbol class_name,
+             const char *kind, const char *message, size_t length) {
+        size_t key = hash(form, filename, line, class_name, message, length);
+        auto range = seen.equal_range(key);
+        for (auto it = range.first; it != range.second; ++it) {
+            const Diagnostic &d = items[it->second];
+            if (d.form == form && d.line == line && d.class_name == class_name &&
+                same_string(d.filename, filename) && d.length == length &&
+                text.compare(d.offset, length, message, length) == 0) {
+                return false;
+            }
+        }
+
+        bool hidden = false;
+        if (max_per_class > 0 && class_name != NULL) {
+            int &count = class_counts[class_name];
+            if (count >= max_per_class) {
+                auto slot = suppressed_index.insert(std::make_pair(class_name, suppressed_counts.size()));
+                if (slot.second) suppressed_counts.push_back(std::make_pair(class_name, 0));
+                suppressed_counts[slot.first->second].second++;
+                suppressed++;
+                hidden = true;
+            } else {
+                count++;
+            }
+        }
+
+        Diagnostic d = { form, filename, line, class_name, kind, text.size(), length, hidden };
+        text.append(message, length);
+        seen.insert(std::make_pair(key, items.size()));
+        items.push_back(d);
+        return true;
+    }
+
+    // 依次追加另一个缓冲区中的错误，返回新增（去重后）的错误数
+    int append(const DiagnosticBuffer &other) {
+        return append(other, 0, other.items.size());
+    }
+
+    // 只追加另一个缓冲区中第 begin 到 end-1 条错误
+    int append(const DiagnosticBuffer &other, size_t begin, size_t end) {
+        int added = 0;
+        for (size_t i = begin; i < end; i++) {
+            const Diagnostic &d = other.items[i];
+            if (add(d.form, d.filename, d.line, d.class_name, d.kind,
+                    other.text.data() + d.offset, d.length)) {
+                added++;
+            }
+        }
+        return added;
+    }
+
+    // 清空内容，保留已分配的内存
+    void clear() {
+        items.clear();
+        text.clear();
+        seen.clear();
+        class_counts.clear();
+        suppressed_counts.clear();
+        suppressed_index.clear();
+        suppressed = 0;
+    }
+
+    size_t size() const { return items.size(); }
+    const Diagnostic &operator[](size_t i) const { return items[i]; }
+    const char *message(const Diagnostic &d) const { return text.data() + d.offset; }
+    int suppressed_count() const { return suppressed; }
+    const std::vector<std::pair<Symbol, int> > &suppressed_by_class() const { return suppressed_counts; }
+
+    // 按现有的文本格式输出，每类被截断的错误数附在最后（按第一次截断的顺序）
+    void render_text(std::string &out) const {
+        for (const Diagnostic &d : items) {
+            if (d.hidden) continue;
+            out += "ERROR: ";
+            if (d.form == DIAG_CLASS && d.class_name != NULL) {
+                out += "In class ";
+                out += d.class_name->get_string();
+                out += ": ";
+            } else if (d.form == DIAG_LOCATION) {
+                out += d.filename != NULL ? d.filename : "";
+                out += ':';
+                out += std::to_string(d.line);
+                out += ": ";
+            }
+            out.append(text, d.offset, d.length);
+            out += '\n';
+        }
+        for (auto &entry : suppressed_counts) {
+            out += "ERROR: In class ";
+            out += entry.first->get_string();
+            out += ": ";
+            out += std::to_string(entry.second);
+            out += " more errors suppressed\n";
+        }
+    }
+
+    // 紧凑的 JSON 格式，整个结果占一行；有说明时附在 "notes" 中
+    void render_json(std::string &out, int total,
+                     const std::vector<DiagnosticNote> &notes = std::vector<DiagnosticNote>()) const {
+        out += "{\"count\":";
+        out += std::to_string(total);
+        out += ",\"suppressed\":";
+        out += std::to_string(suppressed);
+        out += ",\"errors\":[";
+        bool first = true;
+        for (const Diagnostic &d : items) {
+            if (d.hidden) continue;
+            if (!first) out += ',';
+            first = false;
+            out += "{\"file\":";
+            json_string(out, d.filename != NULL ? d.filename : "", -1);
+            out += ",\"line\":";
+            out += std::to_string(d.line);
+            out += ",\"class\":";
+            if (d.class_name != NULL) json_string(out, d.class_name->get_string(), -1);
+            else out += "null";
+            out += ",\"kind\":";
+            json_string(out, d.kind, -1);
+            out += ",\"message\":";
+            json_string(out, text.data() + d.offset, d.length);
+            out += '}';
+        }
+        out += ']';
+        if (!notes.empty()) {
+            out += ",\"notes\":[";
+            for (size_t i = 0; i < notes.size(); i++) {
+                if (i > 0) out += ',';
+                out += "{\"kind\":";
+                json_string(out, notes[i].kind, -1);
+                out += ",\"message\":";
+                json_string(out, notes[i].message.data(), notes[i].message.size());
+                out += '}';
+            }
+            out += ']';
+        }
+        out += "}\n";
+    }
+
+private:
+    std::vector<Diagnostic> items;
+    std::string text;                                   // 所有消息首尾相接
+    std::unordered_multimap<size_t, size_t> seen;       // 哈希 -> items 下标，用于去重
+    std::unordered_map<Symbol, int> class_counts;
+    std::vector<std::pair<Symbol, int> > suppressed_counts;   // 被截断的类及其截断数，按第一次截断的顺序
+    std::unordered_map<Symbol, size_t> suppressed_index;      // 类 -> suppressed_counts 下标
+    int suppressed = 0;
+    int max_per_class;
+
+    static bool same_string(const char *a, const char *b) {
+        if (a == b) return true;
+        if (a == NULL || b == NULL) return false;
+        return strcmp(a, b) == 0;
+    }
+
+    // FNV-1a
+    static size_t hash(DiagnosticForm form, const char *filename, int line, Symbol class_name,
+                       const char *message, size_t length) {
+        size_t h = 1469598103934665603ULL;
+        for (size_t i = 0; i < length; i++) {
+            h ^= (unsigned char) message[i];
+            h *= 1099511628211ULL;
+        }
+        for (const char *p = filename; p != NULL && *p != '\0'; p++) {
+            h ^= (unsigned char) *p;
+            h *= 1099511628211ULL;
+        }
+        h ^= (size_t) line * 0x9E3779B97F4A7C15ULL;
+        h ^= reinterpret_cast<size_t>(class_name) >> 4;
+        return h ^ (size_t) form;
+    }
+};
+
+// semant_error() 返回的输出流：begin() 记下位置信息，之后写入的文本
+// 在遇到换行时作为一条错误提交到目标缓冲区；endl 不会触发系统调用
+class DiagnosticStream : private std::streambuf, public std::ostream {
+public:
+    DiagnosticStream() : std::ostream(this), target(NULL), counter(NULL) {}
+
+    std::ostream &begin(DiagnosticBuffer *buffer, int *added, DiagnosticForm form,
+                        const char *filename, int line, Symbol class_name, const char *kind) {
+        commit();
+        target = buffer;
+        counter = added;
+        pending.form = form;
+        pending.filename = filename;
+        pending.line = line;
+        pending.class_name = class_name;
+        pending.kind = kind;
+        return *this;
+    }
+
+    // 提交尚未以换行结束的消息
+    void commit() {
+        if (target != NULL) {
+            if (target->add(pending.form, pending.filename, pending.line, pending.class_name,
+                            pending.kind, message.data(), message.size()) && counter != NULL) {
+                (*counter)++;
+            }
+        }
+        target = NULL;
+        counter = NULL;
+        message.clear();
+    }
+
+private:
+    DiagnosticBuffer *target;
+    int *counter;           // 新增错误时加一（可为 NULL）
+    Diagnostic pending;
+    std::string message;
+
+    int overflow(int c) {
+        if (c == std::char_traits<char>::eof()) return 0;
+        if (c == '\n') commit();
+        else if (target != NULL) message += (char) c;
+        return c;
+    }
+
+    std::streamsize xsputn(const char *s, std::streamsize n) {
+        for (std::streamsize i = 0; i < n; i++) overflow((unsigned char) s[i]);
+        return n;
+    }
+
+    int sync() { return 0; }
+};
+
+#endif
@@ -0,0 +1,10 @@
+(* Nested.cl - 嵌套表达式的 --stats 计数：每个表达式恰好计一次 *)
+
+class Main {
+   main(): Object {
+      {
+         1 + (2 + (3 + 4));                      (* plus 3，int_const 4 *)
+         if not (not true) then 0 else 1 fi;     (* cond 1，comp 2，bool_const 1，int_const 2 *)
+      }
+   };
+};
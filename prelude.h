@@ -0,0 +1,106 @@
+#ifndef PRELUDE_H
+#define PRELUDE_H
+
+#include <cstddef>
+
+// 基本类的特性签名：Object、IO、Int、Bool、String 的全部方法和属性，
+// 连同每个方法在虚表中的位置，都在编译期写定。方法体和属性初值为 no_expr
+// （由运行时实现），属性类型 _prim_slot 表示运行时的原始值槽。
+// semant.cc 据此在静态存储中建出基本类的 AST，整个进程只建一次，
+// 方法表直接按这里的位置填入，不再逐个特性推算。
+
+struct BuiltinFormal {
+    const char *name;
+    const char *type;
+};
+
+struct BuiltinMethod {
+    const char *name;
+    const char *return_type;
+    int slot;                    // 虚表位置：继承的方法在前，新方法依次追加
+    int formal_count;
+    BuiltinFormal formals[2];
+};
+
+struct BuiltinAttr {
+    const char *name;
+    const char *type;
+};
+
+struct BuiltinClass {
+    const char *name;
+    int parent;                  // 父类在 builtin_classes 中的下标，Object 为 -1
+    const BuiltinMethod *methods;
+    int method_count;
+    const BuiltinAttr *attrs;
+    int attr_count;
+};
+
+const int BUILTIN_MAX_METHODS = 4;
+const int BUILTIN_MAX_ATTRS = 2;
+
+constexpr BuiltinMethod builtin_object_methods[] = {
+    { "abort",      "Object",    0, 0, {} },
+    { "type_name",  "String",    1, 0, {} },
+    { "copy",       "SELF_TYPE", 2, 0, {} },
+};
+
+constexpr BuiltinMethod builtin_io_methods[] = {
+    { "out_string", "SELF_TYPE", 3, 1, { { "arg", "String" } } },
+    { "out_int",    "SELF_TYPE", 4, 1, { { "arg", "Int" } } },
+    { "in_string",  "String",    5, 0, {} },
+    { "in_int",     "Int",       6, 0, {} },
+};
+
+constexpr BuiltinMethod builtin_string_methods[] = {
+    { "length",     "Int",       3, 0, {} },
+    { "concat",     "String",    4, 1, { { "arg", "String" } } },
+    { "substr",     "String",    5, 2, { { "arg", "Int" }, { "arg2", "Int" } } },
+};
+
+constexpr BuiltinAttr builtin_int_attrs[] = {
+    { "_val", "_prim_slot" },
+};
+
+constexpr BuiltinAttr builtin_bool_attrs[] = {
+    { "_val", "_prim_slot" },
+};
+
+constexpr BuiltinAttr builtin_string_attrs[] = {
+    { "_val",       "Int" },          // 字符串长度
+    { "_str_field", "_prim_slot" },
+};
+
+// 顺序即类编号 0..4（见 BASIC_CLASS_COUNT）
+constexpr BuiltinClass builtin_classes[] = {
+    { "Object", -1, builtin_object_methods, 3, NULL, 0 },
+    { "IO",      0, builtin_io_methods,     4, NULL, 0 },
+    { "Int",     0, NULL,                   0, builtin_int_attrs, 1 },
+    { "Bool",    0, NULL,                   0, builtin_bool_attrs, 1 },
+    { "String",  0, builtin_string_methods, 3, builtin_string_attrs, 2 },
+};
+
+const int BUILTIN_CLASS_COUNT = sizeof(builtin_classes) / sizeof(builtin_classes[0]);
+
+// 类的虚表长度：父类的长度加上自己新增的方法数（基本类之间没有重写）
+constexpr int builtin_vtable_size(int c) {
+    return c < 0 ? 0 : builtin_vtable_size(builtin_classes[c].parent) + builtin_classes[c].method_count;
+}
+
+// 每个类新增的方法依次占用父类虚表之后的位置，父类总在子类之前
+constexpr bool builtin_slots_valid() {
+    for (int c = 0; c < BUILTIN_CLASS_COUNT; c++) {
+        const BuiltinClass &cls = builtin_classes[c];
+        if (cls.parent >= c || cls.method_count > BUILTIN_MAX_METHODS || cls.attr_count > BUILTIN_MAX_ATTRS) {
+            return false;
+        }
+        for (int m = 0; m < cls.method_count; m++) {
+            if (cls.methods[m].slot != builtin_vtable_size(cls.parent) + m) return false;
+        }
+    }
+    return true;
+}
+
+static_assert(builtin_slots_valid(), "prelude.h 中基本类方法的虚表位置不连续");
+
+#endif
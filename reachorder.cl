@@ -0,0 +1,14 @@
+(* Reachorder.cl - --reachable 的错误顺序：main 先调用 b 再调用 a，
+   错误仍按方法的源码顺序（a、b）输出，与全量检查相同；c 不可达 *)
+
+class Main {
+   a(): Object { undefined_in_a };
+   b(): Object { undefined_in_b };
+   main(): Object {
+      {
+         b();
+         a();
+      }
+   };
+   c(): Object { undefined_in_c };
+};
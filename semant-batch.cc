@@ -0,0 +1,180 @@
+// semant-batch.cc - 批处理语义分析驱动
+//
+// 在一个进程内依次检查多个程序，基本类只安装一次，
+// 各阶段的表在程序之间复用，避免每个程序都启动一次 semant 进程。
+//
+// 用法: semant-batch [--dump] [语义分析选项] [AST文件...]
+//   --dump 在每个程序的错误之后输出标注了类型的 AST（dump_with_types 格式）
+//   给出文件时，每个文件是一个程序的 parser 输出，或 ast-convert 生成的二进制 AST
+//   （按文件开头的魔数识别，mmap 后一次建树）；
+//   不给文件时从标准输入读取，多个程序的 parser 输出直接首尾相接，
+//   以每个程序开头的 "#行号" + "_program" 两行为分界。
+//
+// 每个程序的错误输出写到标准输出，以如下两行为界：
+//   --- <名字>
+//   --- end <名字>: <错误数> errors
+// 结束时在标准错误输出处理的程序数和吞吐量。
+// 批处理模式不支持 --cache（缓存以类名为键，不能跨程序共用）。
+
+#include "ast-binary.h"
+#include "semant.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// AST 读取器（ast-lex.cc / ast-parse.cc）
+extern FILE *ast_file;
+extern int ast_yyparse(void);
+extern void ast_yyrestart(FILE *file);
+extern Program ast_root;
+
+static bool dump_types = false;
+
+struct BatchTotals {
+    long programs = 0;
+    long failed = 0;      // 有语义错误或无法读取的程序数
+};
+
+// 对已建好的 AST 做语义分析，输出错误和结束行
+static void check_tree(const std::string &name, Program root, std::ostream &out,
+                       BatchTotals &totals) {
+    // 语义错误都写到 cool::cerr，检查期间把它接到缓冲区上
+    std::ostringstream diagnostics;
+    std::streambuf *saved = cool::cerr.rdbuf(diagnostics.rdbuf());
+    semant_errors = 0;
+    root->semant();
+    cool::cerr.rdbuf(saved);
+
+    out << diagnostics.str();
+    if (dump_types) root->dump_with_types(out, 0);
+    out << "--- end " << name << ": " << semant_errors << " errors" << std::endl;
+    if (semant_errors > 0) totals.failed++;
+}
+
+// 检查一个程序的文本 AST，错误输出按分界格式写到 out
+static void check_program(const std::string &name, const std::string &ast,
+                          std::ostream &out, BatchTotals &totals) {
+    totals.programs++;
+    out << "--- " << name << "\n";
+
+    FILE *file = fmemopen((void *) ast.data(), ast.size(), "r");
+    if (file == NULL) {
+        out << "ERROR: cannot read AST\n";
+        out << "--- end " << name << ": 1 errors" << std::endl;
+        totals.failed++;
+        return;
+    }
+    ast_file = file;
+    ast_yyrestart(ast_file);
+    ast_root = NULL;
+    int parse_status = ast_yyparse();
+    fclose(file);
+
+    if (parse_status != 0 || ast_root == NULL) {
+        out << "ERROR: malformed AST\n";
+        out << "--- end " << name << ": 1 errors" << std::endl;
+        totals.failed++;
+        return;
+    }
+    check_tree(name, ast_root, out, totals);
+}
+
+// 检查一个二进制 AST 文件
+static void check_binary(const char *path, std::ostream &out, BatchTotals &totals) {
+    totals.programs++;
+    out << "--- " << path << "\n";
+
+    std::string error;
+    Program root = read_binary_ast(path, error);
+    if (root == NULL) {
+        out << "ERROR: " << path << ": " << error << "\n";
+        out << "--- end " << path << ": 1 errors" << std::endl;
+        totals.failed++;
+        return;
+    }
+    check_tree(path, root, out, totals);
+}
+
+static bool read_file(const char *path, std::string &text) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    std::ostringstream buffer;
+    buffer << in.rdbuf();
+    text = buffer.str();
+    return true;
+}
+
+// 逐行读取标准输入，遇到下一个程序的开头就检查已读入的程序
+static void check_stream(std::istream &in, std::ostream &out, BatchTotals &totals) {
+    std::string current;        // 当前程序已读入的文本
+    size_t last_line = 0;       // current 中最后一行的起点
+    std::string line;
+    int index = 0;
+    while (std::getline(in, line)) {
+        if (line == "_program" && last_line > 0) {
+            // 上一行 "#行号" 属于新程序
+            std::string next = current.substr(last_line);
+            current.resize(last_line);
+            check_program("<stdin>:" + std::to_string(++index), current, out, totals);
+            current = next;
+        }
+        last_line = current.size();
+        current += line;
+        current += '\n';
+    }
+    if (current.find_first_not_of(" \t\n") != std::string::npos) {
+        check_program("<stdin>:" + std::to_string(++index), current, out, totals);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    handle_semant_flags(argc, argv);
+    int files = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--dump") == 0) dump_types = true;
+        else argv[files++] = argv[i];
+    }
+    argc = files;
+    if (semant_cache_file != NULL) {
+        std::cerr << "semant-batch: --cache is ignored in batch mode" << std::endl;
+        semant_cache_file = NULL;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    BatchTotals totals;
+    semant_begin_batch();
+
+    if (argc <= 1) {
+        check_stream(std::cin, std::cout, totals);
+    } else {
+        std::string text;
+        for (int i = 1; i < argc; i++) {
+            if (is_binary_ast(argv[i])) {
+                check_binary(argv[i], std::cout, totals);
+                continue;
+            }
+            if (!read_file(argv[i], text)) {
+                std::cout << "--- " << argv[i] << "\n"
+                          << "ERROR: cannot open " << argv[i] << "\n"
+                          << "--- end " << argv[i] << ": 1 errors" << std::endl;
+                totals.programs++;
+                totals.failed++;
+                continue;
+            }
+            check_program(argv[i], text, std::cout, totals);
+        }
+    }
+
+    semant_end_batch();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    double seconds = elapsed.count();
+    std::cerr << totals.programs << " programs, " << totals.failed << " with errors, "
+              << seconds << " s";
+    if (seconds > 0) std::cerr << " (" << (long) (totals.programs / seconds) << " programs/sec)";
+    std::cerr << std::endl;
+    return totals.failed > 0 ? 1 : 0;
+}
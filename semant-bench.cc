@@ -0,0 +1,244 @@
+// semant-bench.cc - 语义分析器性能测试
+//
+// 在进程内生成合成的 COOL 程序 AST（不经过 lexer/parser），
+// 运行与 program_class::semant() 相同的 ClassTable 流水线，
+// 报告各阶段耗时、nodes/sec 和峰值内存。
+//
+// 用法: semant-bench [选项]
+//   --classes N    类的个数（默认 1000）
+//   --depth D      继承链深度（默认 10）
+//   --methods M    每个类的方法数（默认 20）
+//   --nesting E    每个方法体的表达式嵌套深度（默认 8）
+//   --chain L      每个方法体中 SELF_TYPE 方法链的长度（默认 5）
+//   --repeat R     重复运行次数，取最好的一次（默认 3）
+//   -j N           并行检查类的线程数
+//   --stats        输出计数器（需以 -DSEMANT_STATS 编译）
+
+#include "semant.h"
+#include "cool-tree.handcode.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+struct BenchParams {
+    int classes = 1000;
+    int depth = 10;
+    int methods = 20;
+    int nesting = 8;
+    int chain = 5;
+    int repeat = 3;
+};
+
+// 合成程序生成器
+class ProgramGenerator {
+public:
+    explicit ProgramGenerator(const BenchParams &params) : params(params), nodes(0) {
+        filename = stringtable.add_string((char *) "<bench>");
+        x = sym("x");
+        o = sym("o");
+        step = sym("step");
+    }
+
+    Classes generate() {
+        Classes result = single_Classes(main_class());
+        for (int i = 0; i < params.classes; i++) {
+            result = append_Classes(result, single_Classes(user_class(i)));
+        }
+        return result;
+    }
+
+    long node_count() const { return nodes; }
+
+private:
+    const BenchParams &params;
+    long nodes;
+    Symbol filename;
+    Symbol x;
+    Symbol o;
+    Symbol step;
+
+    static Symbol sym(const std::string &name) {
+        return idtable.add_string((char *) name.c_str());
+    }
+
+    static Symbol int_sym(int value) {
+        return inttable.add_string((char *) std::to_string(value).c_str());
+    }
+
+    static Symbol class_name(int i) {
+        return sym("C" + std::to_string(i));
+    }
+
+    static Symbol method_name(int k) {
+        return sym("m" + std::to_string(k));
+    }
+
+    Expression count(Expression e) {
+        nodes++;
+        return e;
+    }
+
+    Class_ main_class() {
+        node_lineno = 1;
+        Feature main_method = method(sym("main"), nil_Formals(), Object,
+                                     count(int_const(int_sym(0))));
+        return class_(sym("Main"), Object, single_Features(main_method), filename);
+    }
+
+    // Ci 继承 Ci-1，每 depth 个类从 Object 开始一条新的继承链；
+    // 链根定义 step(): SELF_TYPE，所有类都定义（或重写）m0..m{M-1}
+    Class_ user_class(int i) {
+        bool root = i % params.depth == 0;
+        Symbol name = class_name(i);
+        Symbol parent = root ? Object : class_name(i - 1);
+
+        Features features = nil_Features();
+        if (root) {
+            node_lineno++;
+            Feature step_method = method(step, nil_Formals(), SELF_TYPE, count(var(self)));
+            features = append_Features(features, single_Features(step_method));
+        }
+        for (int k = 0; k < params.methods; k++) {
+            node_lineno++;
+            Formals formals = append_Formals(single_Formals(formal(x, Int)),
+                                             single_Formals(formal(o, Object)));
+            Feature m = method(method_name(k), formals, Int, body(name, params.nesting));
+            features = append_Features(features, single_Features(m));
+        }
+        return class_(name, parent, features, filename);
+    }
+
+    // 嵌套深度为 e 的 Int 表达式，依次使用算术、条件、let 和块
+    Expression body(Symbol cls, int e) {
+        if (e == 0) return dispatch_chain(cls);
+
+        Expression inner = body(cls, e - 1);
+        switch (e % 4) {
+        case 0:
+            return count(plus(inner, count(int_const(int_sym(e)))));
+        case 1:
+            return count(cond(count(lt(count(var(x)), count(int_const(int_sym(e))))),
+                              inner,
+                              count(int_const(int_sym(0)))));
+        case 2: {
+            Symbol v = sym("v" + std::to_string(e));
+            return count(let(v, Int, count(var(x)),
+                             count(plus(count(var(v)), inner))));
+        }
+        default: {
+            Expressions stmts = append_Expressions(single_Expressions(count(isvoid(count(var(o))))),
+                                                   single_Expressions(inner));
+            return count(block(stmts));
+        }
+        }
+    }
+
+    // (new C).step().step()...step().m0(x, o)
+    Expression dispatch_chain(Symbol cls) {
+        Expression receiver = count(new_(cls));
+        for (int i = 0; i < params.chain; i++) {
+            receiver = count(dispatch(receiver, step, nil_Expressions()));
+        }
+        Expressions actuals = append_Expressions(single_Expressions(count(var(x))),
+                                                 single_Expressions(count(var(o))));
+        return count(dispatch(receiver, method_name(0), actuals));
+    }
+};
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+int main(int argc, char *argv[]) {
+    handle_semant_flags(argc, argv);
+
+    // handle_semant_flags 已移除 -j、--stats 等选项（缺少值的除外），
+    // 剩下的逐个解析，每个选项都要带一个值
+    BenchParams params;
+    for (int i = 1; i < argc; i++) {
+        const char *opt = argv[i];
+        int *target = NULL;
+        if (strcmp(opt, "--classes") == 0) target = &params.classes;
+        else if (strcmp(opt, "--depth") == 0) target = &params.depth;
+        else if (strcmp(opt, "--methods") == 0) target = &params.methods;
+        else if (strcmp(opt, "--nesting") == 0) target = &params.nesting;
+        else if (strcmp(opt, "--chain") == 0) target = &params.chain;
+        else if (strcmp(opt, "--repeat") == 0) target = &params.repeat;
+        if (target == NULL || i + 1 >= argc) {
+            std::cerr << "Unknown option " << opt << (target != NULL ? " (missing value)" : "") << std::endl;
+            return 1;
+        }
+        *target = atoi(argv[++i]);
+    }
+    if (params.depth < 1) params.depth = 1;
+    if (params.methods < 1) params.methods = 1;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    ProgramGenerator generator(params);
+    Classes classes = generator.generate();
+    double generate_seconds = seconds_since(start);
+    long nodes = generator.node_count();
+
+    printf("classes=%d depth=%d methods=%d nesting=%d chain=%d jobs=%d\n",
+           params.classes, params.depth, params.methods, params.nesting,
+           params.chain, semant_jobs);
+    printf("generated %ld expression nodes in %.3f s\n", nodes, generate_seconds);
+
+    // 每次重复都在同一棵 AST 上重新构造 ClassTable，各阶段耗时取最好成绩，
+    // 常驻内存增量取最大值（之后的重复多半复用已释放的内存，增量接近 0）
+    double best[PHASE_COUNT];
+    long rss[PHASE_COUNT];
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        best[p] = -1;
+        rss[p] = 0;
+    }
+    double best_total = -1;
+    long rss_total = 0;
+    for (int r = 0; r < params.repeat; r++) {
+        semant_errors = 0;
+        long rss_before = current_rss_kb();
+        start = std::chrono::steady_clock::now();
+        ClassTable *table = new ClassTable(classes);
+        double total = seconds_since(start);
+        long rss_used = current_rss_kb() - rss_before;
+        if (rss_used > rss_total) rss_total = rss_used;
+        int errors = semant_errors;
+        flush_semant_diagnostics(std::cerr);
+        semant_errors = errors;
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            if (best[p] < 0 || table->phase_seconds[p] < best[p]) best[p] = table->phase_seconds[p];
+            if (table->phase_rss_delta_kb[p] > rss[p]) rss[p] = table->phase_rss_delta_kb[p];
+        }
+        if (best_total < 0 || total < best_total) best_total = total;
+        
+        // --stats：计数器累计所有重复，阶段耗时取最后一次
+        if (r == params.repeat - 1 && semant_print_stats) {
+            flush_semant_stats();
+            print_semant_stats(table, std::cerr);
+        }
+        delete table;
+    }
+
+    if (semant_errors > 0) {
+        printf("warning: generated program has %d semantic errors\n", semant_errors);
+    }
+
+    printf("%-26s %12s %14s %12s\n", "phase", "time (ms)", "nodes/sec", "RSS +KB");
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        // 只有 type_check 阶段按表达式节点计算吞吐量
+        if (p == PHASE_TYPE_CHECK && best[p] > 0) {
+            printf("%-26s %12.3f %14.0f %12ld\n", semant_phase_names[p], best[p] * 1000,
+                   nodes / best[p], rss[p]);
+        } else {
+            printf("%-26s %12.3f %14s %12ld\n", semant_phase_names[p], best[p] * 1000, "-", rss[p]);
+        }
+    }
+    printf("%-26s %12.3f %14.0f %12ld\n", "total", best_total * 1000,
+           best_total > 0 ? nodes / best_total : 0, rss_total);
+    printf("process max RSS so far: %ld KB\n", peak_rss_kb());
+    return 0;
+}
@@ -0,0 +1,766 @@
+// semant-daemon.cc - 常驻语义分析进程
+//
+// 编辑器每次停顿都运行一遍 lexer | parser | semant，每次都重建整个 ClassTable。
+// semant-daemon 常驻内存，保留所有类的 AST、基本类、方法表和每个类的检查结果，
+// 从标准输入逐行读取 JSON 请求，每个请求在标准输出回答一行 JSON。
+//
+// 用法: semant-daemon [语义分析选项]
+//
+// 请求（"id" 可选，原样带回）：
+//   {"op":"update","file":F,"ast":TEXT}   用 parser 的文本输出替换文件 F 中的全部类
+//   {"op":"update","file":F,"path":P}     同上，AST 从文件 P 读取（文本或二进制 AST）
+//   {"op":"remove","file":F}              删除文件 F 中的全部类
+//   {"op":"errors"}                       最近一次检查的错误
+//   {"op":"type_at","file":F,"line":N}    文件 F 第 N 行上的表达式及其静态类型，由外到内
+//   {"op":"methods","type":T}             类型 T 上可以调用的方法，按虚表位置排列
+//   {"op":"shutdown"}
+//
+// 回答都带 "ok" 和处理耗时 "ms"，失败时带 "error"。update 和 remove 之后重新检查，
+// 回答中带检查和跳过的类数以及 "diagnostics"（格式同 --diagnostics=json）。
+//
+// 重新检查时继承图、层次索引和方法表整体重建（与类数成线性，远小于类型检查）；
+// 类型检查只对 AST 改变或所依赖类型的接口签名改变的类进行（内存中的 --cache），
+// 文本相同的类保留原来的 AST 对象，上次的类型标注仍然有效。查询只读内存中的表。
+//
+// 保留的类都在二进制 AST 读入时建成的整块内存中（文本 AST 在子进程中解析并
+// 转成二进制格式传回），一块中的类都被替换或删除后整块释放。
+
+#include "ast-binary.h"
+#include "semant.h"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+// AST 读取器（ast-lex.cc / ast-parse.cc）
+extern FILE *ast_file;
+extern int ast_yyparse(void);
+extern void ast_yyrestart(FILE *file);
+extern Program ast_root;
+
+////////////////////////////////////////////////////////////////////
+//
+// 请求解析：只支持一层对象，值为字符串、数字、true/false/null
+//
+////////////////////////////////////////////////////////////////////
+
+struct JsonValue {
+    bool is_string;
+    std::string text;     // 字符串为解码后的内容，其他值为原文
+};
+
+typedef std::unordered_map<std::string, JsonValue> Request;
+
+static void skip_space(const std::string &s, size_t &i) {
+    while (i < s.size() && (s[i] == ' ' || s[i] == '\t' || s[i] == '\r' || s[i] == '\n')) i++;
+}
+
+static void append_utf8(std::string &out, unsigned code) {
+    if (code < 0x80) {
+        out += (char) code;
+    } else if (code < 0x800) {
+        out += (char) (0xC0 | (code >> 6));
+        out += (char) (0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+        out += (char) (0xE0 | (code >> 12));
+        out += (char) (0x80 | ((code >> 6) & 0x3F));
+        out += (char) (0x80 | (code & 0x3F));
+    } else {
+        out += (char) (0xF0 | (code >> 18));
+        out += (char) (0x80 | ((code >> 12) & 0x3F));
+        out += (char) (0x80 | ((code >> 6) & 0x3F));
+        out += (char) (0x80 | (code & 0x3F));
+    }
+}
+
+static bool parse_hex4(const std::string &s, size_t i, unsigned &code) {
+    if (i + 4 > s.size()) return false;
+    code = 0;
+    for (size_t k = i; k < i + 4; k++) {
+        char c = s[k];
+        code <<= 4;
+        if (c >= '0' && c <= '9') code |= c - '0';
+        else if (c >= 'a' && c <= 'f') code |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') code |= c - 'A' + 10;
+        else return false;
+    }
+    return true;
+}
+
+// s[i] 为开头的引号，结束时 i 指向结尾引号之后
+static bool parse_string(const std::string &s, size_t &i, std::string &out) {
+    out.clear();
+    for (i++; i < s.size(); i++) {
+        char c = s[i];
+        if (c == '"') {
+            i++;
+            return true;
+        }
+        if (c != '\\') {
+            out += c;
+            continue;
+        }
+        if (++i >= s.size()) return false;
+        switch (s[i]) {
+        case '"': out += '"'; break;
+        case '\\': out += '\\'; break;
+        case '/': out += '/'; break;
+        case 'b': out += '\b'; break;
+        case 'f': out += '\f'; break;
+        case 'n': out += '\n'; break;
+        case 'r': out += '\r'; break;
+        case 't': out += '\t'; break;
+        case 'u': {
+            unsigned code, low;
+            if (!parse_hex4(s, i + 1, code)) return false;
+            i += 4;
+            // 代理对
+            if (code >= 0xD800 && code < 0xDC00 && i + 2 < s.size() && s[i + 1] == '\\' &&
+                s[i + 2] == 'u' && parse_hex4(s, i + 3, low) && low >= 0xDC00 && low < 0xE000) {
+                code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                i += 6;
+            }
+            append_utf8(out, code);
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+    return false;
+}
+
+static bool parse_request(const std::string &line, Request &request, std::string &error) {
+    size_t i = 0;
+    skip_space(line, i);
+    if (i >= line.size() || line[i] != '{') {
+        error = "request must be a JSON object";
+        return false;
+    }
+    i++;
+    skip_space(line, i);
+    if (i < line.size() && line[i] == '}') return true;
+    while (i < line.size()) {
+        std::string key;
+        skip_space(line, i);
+        if (i >= line.size() || line[i] != '"' || !parse_string(line, i, key)) break;
+        skip_space(line, i);
+        if (i >= line.size() || line[i] != ':') break;
+        i++;
+        skip_space(line, i);
+        if (i >= line.size()) break;
+
+        JsonValue value;
+        if (line[i] == '"') {
+            value.is_string = true;
+            if (!parse_string(line, i, value.text)) break;
+        } else if (line[i] == '{' || line[i] == '[') {
+            error = "nested values are not supported";
+            return false;
+        } else {
+            value.is_string = false;
+            size_t start = i;
+            while (i < line.size() && line[i] != ',' && line[i] != '}' &&
+                   line[i] != ' ' && line[i] != '\t' && line[i] != '\r') i++;
+            value.text = line.substr(start, i - start);
+        }
+        request[key] = value;
+
+        skip_space(line, i);
+        if (i < line.size() && line[i] == ',') {
+            i++;
+            continue;
+        }
+        if (i < line.size() && line[i] == '}') return true;
+        break;
+    }
+    error = "malformed JSON request";
+    return false;
+}
+
+static const JsonValue *field(const Request &request, const char *name) {
+    auto it = request.find(name);
+    return it != request.end() ? &it->second : NULL;
+}
+
+////////////////////////////////////////////////////////////////////
+//
+// 常驻状态
+//
+////////////////////////////////////////////////////////////////////
+
+// 一个源文件中的类，每个类的 AST 指纹，以及它所在的二进制 AST 块（以块的 program 结点表示）
+struct SourceFile {
+    std::string name;
+    std::vector<Class_> classes;
+    std::vector<unsigned long long> fingerprints;
+    std::vector<Program> blocks;
+};
+
+// 行号索引中的一个表达式
+struct LineEntry {
+    int line;
+    int depth;            // 在所属特性中的嵌套深度
+    Expression expr;
+    Class_ owner;
+    Symbol feature;
+};
+
+// 把子表达式按源码顺序的逆序压栈，出栈时即为先序
+static void push_children(Expression e, int depth, std::vector<std::pair<Expression, int> > &stack) {
+    Expression child[3] = { NULL, NULL, NULL };
+    Expressions list = NULL;
+    ExprKind kind = expr_kind(e);
+    switch (kind) {
+    case EXPR_ASSIGN:
+        child[0] = static_cast<assign_class *>(e)->get_expr();
+        break;
+    case EXPR_DISPATCH:
+        child[0] = static_cast<dispatch_class *>(e)->get_expr();
+        list = static_cast<dispatch_class *>(e)->get_actuals();
+        break;
+    case EXPR_STATIC_DISPATCH:
+        child[0] = static_cast<static_dispatch_class *>(e)->get_expr();
+        list = static_cast<static_dispatch_class *>(e)->get_actuals();
+        break;
+    case EXPR_COND:
+        child[0] = static_cast<cond_class *>(e)->get_pred();
+        child[1] = static_cast<cond_class *>(e)->get_then_exp();
+        child[2] = static_cast<cond_class *>(e)->get_else_exp();
+        break;
+    case EXPR_LOOP:
+        child[0] = static_cast<loop_class *>(e)->get_pred();
+        child[1] = static_cast<loop_class *>(e)->get_body();
+        break;
+    case EXPR_BLOCK:
+        list = static_cast<block_class *>(e)->get_body();
+        break;
+    case EXPR_LET:
+        child[0] = static_cast<let_class *>(e)->get_init();
+        child[1] = static_cast<let_class *>(e)->get_body();
+        break;
+    case EXPR_TYPCASE: {
+        Cases cases = static_cast<typcase_class *>(e)->get_cases();
+        for (int i = cases->len() - 1; i >= 0; i--) {
+            Branch branch = cases->nth(i);
+            stack.push_back(std::make_pair(branch->get_expr(), depth + 1));
+        }
+        child[0] = static_cast<typcase_class *>(e)->get_expr();
+        break;
+    }
+    case EXPR_NEG:
+        child[0] = static_cast<neg_class *>(e)->get_expr();
+        break;
+    case EXPR_COMP:
+        child[0] = static_cast<comp_class *>(e)->get_expr();
+        break;
+    case EXPR_ISVOID:
+        child[0] = static_cast<isvoid_class *>(e)->get_expr();
+        break;
+    case EXPR_PLUS: case EXPR_MINUS: case EXPR_TIMES: case EXPR_DIVIDE:
+    case EXPR_LT: case EXPR_LEQ: case EXPR_EQ:
+        binary_operands(kind, e, child[0], child[1]);
+        break;
+    default:
+        break;
+    }
+    if (list != NULL) {
+        for (int i = list->len() - 1; i >= 0; i--) {
+            stack.push_back(std::make_pair(list->nth(i), depth + 1));
+        }
+    }
+    for (int k = 2; k >= 0; k--) {
+        if (child[k] != NULL) stack.push_back(std::make_pair(child[k], depth + 1));
+    }
+}
+
+// 文本 AST 在子进程中解析，转成二进制格式经管道传回后读入：parser 建的树
+// （含列表结点）无法逐个释放，子进程退出时一并回收
+static Program parse_text_ast(const std::string &text, std::string &error) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        error = "cannot create pipe";
+        return NULL;
+    }
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        error = "cannot fork";
+        return NULL;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        FILE *file = fmemopen((void *) text.data(), text.size(), "r");
+        if (file == NULL) _exit(1);
+        ast_file = file;
+        ast_yyrestart(ast_file);
+        ast_root = NULL;
+        if (ast_yyparse() != 0 || ast_root == NULL) _exit(1);
+        std::ostringstream out;
+        write_binary_ast(ast_root, out);
+        const std::string bytes = out.str();
+        for (size_t done = 0; done < bytes.size(); ) {
+            ssize_t n = write(fds[1], bytes.data() + done, bytes.size() - done);
+            if (n <= 0) _exit(1);
+            done += n;
+        }
+        _exit(0);
+    }
+
+    close(fds[1]);
+    std::string bytes;
+    char buffer[65536];
+    ssize_t n;
+    while ((n = read(fds[0], buffer, sizeof(buffer))) > 0) bytes.append(buffer, n);
+    close(fds[0]);
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {}
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        error = "malformed AST";
+        return NULL;
+    }
+    return read_binary_ast(bytes.data(), bytes.size(), error);
+}
+
+// 重新检查用的 program 结点和类列表结点。每次检查重建，建在同一块可复用的
+// 内存中；列表为平衡的 append 树，len()/nth() 的递归深度随类数对数增长
+class ProgramStorage {
+public:
+    ProgramStorage() : memory(NULL), capacity(0), cursor(NULL) {}
+    ~ProgramStorage() { free(memory); }
+
+    Program build(const std::vector<Class_> &all) {
+        size_t count = all.size();
+        size_t size = object_size(sizeof(program_class)) +
+                      (count == 0 ? object_size(sizeof(nil_node<Class_>))
+                                  : count * object_size(sizeof(single_list_node<Class_>)) +
+                                    (count - 1) * object_size(sizeof(append_node<Class_>)));
+        if (size > capacity) {
+            free(memory);
+            capacity = std::max(size, capacity * 2);
+            memory = (char *) malloc(capacity);
+            if (memory == NULL) throw std::bad_alloc();
+        }
+        cursor = memory;
+        int saved_lineno = node_lineno;
+        node_lineno = 0;
+        Classes classes = count == 0 ? make<nil_node<Class_> >() : balanced(all, 0, count);
+        Program root = make<program_class>(classes);
+        node_lineno = saved_lineno;
+        return root;
+    }
+
+private:
+    char *memory;
+    size_t capacity;
+    char *cursor;
+
+    static size_t object_size(size_t size) {
+        const size_t align = alignof(std::max_align_t);
+        return (size + align - 1) & ~(align - 1);
+    }
+
+    template <class T, class... Args>
+    T *make(Args... args) {
+        void *p = cursor;
+        cursor += object_size(sizeof(T));
+        return new (p) T(args...);
+    }
+
+    list_node<Class_> *balanced(const std::vector<Class_> &all, size_t begin, size_t end) {
+        if (end - begin == 1) return make<single_list_node<Class_> >(all[begin]);
+        size_t mid = begin + (end - begin) / 2;
+        list_node<Class_> *left = balanced(all, begin, mid);
+        list_node<Class_> *right = balanced(all, mid, end);
+        return make<append_node<Class_> >(left, right);
+    }
+};
+
+class SemantDaemon {
+public:
+    SemantDaemon() : index_valid(false) {
+        recheck();
+    }
+
+    // 处理一行请求，回答写入 response；返回 false 表示退出
+    bool handle(const std::string &line, std::string &response) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        Request request;
+        std::string error;
+        bool running = true;
+        std::string body;
+
+        if (parse_request(line, request, error)) {
+            const JsonValue *op = field(request, "op");
+            if (op == NULL || !op->is_string) error = "missing \"op\"";
+            else if (op->text == "update") update(request, body, error);
+            else if (op->text == "remove") remove(request, body, error);
+            else if (op->text == "errors") body = ",\"diagnostics\":" + diagnostics;
+            else if (op->text == "type_at") type_at(request, body, error);
+            else if (op->text == "methods") methods(request, body, error);
+            else if (op->text == "shutdown") running = false;
+            else error = "unknown op \"" + op->text + "\"";
+        }
+
+        response = "{";
+        const JsonValue *id = field(request, "id");
+        if (id != NULL) {
+            response += "\"id\":";
+            if (id->is_string) json_string(response, id->text.c_str());
+            else response += id->text;
+            response += ',';
+        }
+        if (error.empty()) {
+            response += "\"ok\":true";
+            response += body;
+        } else {
+            response += "\"ok\":false,\"error\":";
+            json_string(response, error.c_str());
+        }
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        char ms[32];
+        snprintf(ms, sizeof(ms), ",\"ms\":%.3f}", elapsed.count());
+        response += ms;
+        return running;
+    }
+
+private:
+    std::vector<SourceFile> files;     // 按第一次 update 的顺序
+    std::unordered_map<Program, int> block_classes;   // 每个二进制 AST 块中仍被保留的类数
+    std::vector<Program> released;     // 已无类保留的块，重新检查之后释放
+    ProgramStorage storage;
+    std::string diagnostics;           // 最近一次检查的错误（JSON）
+    int checked_classes;
+    int skipped_classes;
+
+    // 按文件建立的行号索引，检查后第一次 type_at 时建立
+    std::unordered_map<std::string, std::vector<LineEntry> > line_index;
+    bool index_valid;
+
+    SourceFile *find_file(const std::string &name) {
+        for (size_t i = 0; i < files.size(); i++) {
+            if (files[i].name == name) return &files[i];
+        }
+        return NULL;
+    }
+
+    static bool string_field(const Request &request, const char *name, std::string &value,
+                             std::string &error) {
+        const JsonValue *v = field(request, name);
+        if (v == NULL || !v->is_string) {
+            error = std::string("missing \"") + name + "\"";
+            return false;
+        }
+        value = v->text;
+        return true;
+    }
+
+    // 读入一个程序的 AST：文本由请求直接给出，或从文件读取（文本或二进制）。
+    // 返回的树总是二进制 AST 块，可以用 free_binary_ast 释放
+    static Program load_program(const Request &request, std::string &error) {
+        std::string text;
+        const JsonValue *ast = field(request, "ast");
+        const JsonValue *path = field(request, "path");
+        if (ast != NULL && ast->is_string) {
+            text = ast->text;
+        } else if (path != NULL && path->is_string) {
+            if (is_binary_ast(path->text.c_str())) {
+                Program root = read_binary_ast(path->text.c_str(), error);
+                if (root == NULL) error = path->text + ": " + error;
+                return root;
+            }
+            std::ifstream in(path->text.c_str(), std::ios::binary);
+            if (!in) {
+                error = "cannot open " + path->text;
+                return NULL;
+            }
+            std::ostringstream buffer;
+            buffer << in.rdbuf();
+            text = buffer.str();
+        } else {
+            error = "update needs \"ast\" or \"path\"";
+            return NULL;
+        }
+        return parse_text_ast(text, error);
+    }
+
+    // 块中又有一个类不再保留；全部不再保留时在下次检查之后释放
+    void release_class(Program block) {
+        if (--block_classes[block] == 0) {
+            block_classes.erase(block);
+            released.push_back(block);
+        }
+    }
+
+    void update(const Request &request, std::string &body, std::string &error) {
+        std::string name;
+        if (!string_field(request, "file", name, error)) return;
+        Program root = load_program(request, error);
+        if (root == NULL) return;
+
+        SourceFile *file = find_file(name);
+        if (file == NULL) {
+            files.push_back(SourceFile());
+            file = &files.back();
+            file->name = name;
+        }
+
+        // 同名且指纹相同的类沿用原来的对象（及其类型标注），增量检查据此跳过它；
+        // 新读入的块中没有被采用的类随块一起释放
+        std::vector<Class_> classes;
+        std::vector<unsigned long long> fingerprints;
+        std::vector<Program> blocks;
+        std::vector<char> kept(file->classes.size(), 0);
+        int adopted = 0;
+        Classes list = static_cast<program_class *>(root)->get_classes();
+        for (int i = list->first(); list->more(i); i = list->next(i)) {
+            Class_ c = list->nth(i);
+            unsigned long long fingerprint = ClassTable::class_fingerprint(c);
+            Program block = root;
+            for (size_t k = 0; k < file->classes.size(); k++) {
+                if (!kept[k] && file->fingerprints[k] == fingerprint &&
+                    file->classes[k]->get_name() == c->get_name()) {
+                    c = file->classes[k];
+                    block = file->blocks[k];
+                    kept[k] = 1;
+                    break;
+                }
+            }
+            if (block == root) adopted++;
+            classes.push_back(c);
+            fingerprints.push_back(fingerprint);
+            blocks.push_back(block);
+        }
+        for (size_t k = 0; k < file->classes.size(); k++) {
+            if (!kept[k]) release_class(file->blocks[k]);
+        }
+        if (adopted > 0) block_classes[root] = adopted;
+        else released.push_back(root);
+        file->classes.swap(classes);
+        file->fingerprints.swap(fingerprints);
+        file->blocks.swap(blocks);
+
+        recheck();
+        check_summary(body);
+    }
+
+    void remove(const Request &request, std::string &body, std::string &error) {
+        std::string name;
+        if (!string_field(request, "file", name, error)) return;
+        SourceFile *file = find_file(name);
+        if (file == NULL) {
+            error = "unknown file " + name;
+            return;
+        }
+        for (Program block : file->blocks) release_class(block);
+        files.erase(files.begin() + (file - &files[0]));
+        recheck();
+        check_summary(body);
+    }
+
+    // 用所有文件中的类重新检查，错误以 JSON 格式保存。上一次检查建的表
+    // 可能还指向被替换的类，检查完成后才释放不再保留的块
+    void recheck() {
+        std::vector<Class_> all;
+        std::unordered_map<Class_, unsigned long long> fingerprints;
+        for (size_t i = 0; i < files.size(); i++) {
+            all.insert(all.end(), files[i].classes.begin(), files[i].classes.end());
+            for (size_t k = 0; k < files[i].classes.size(); k++) {
+                fingerprints[files[i].classes[k]] = files[i].fingerprints[k];
+            }
+        }
+        Program root = storage.build(all);
+
+        // 指纹在 update 时已算好（只算重新读入的文件），检查时不再重算
+        std::ostringstream errors;
+        std::streambuf *saved = cool::cerr.rdbuf(errors.rdbuf());
+        semant_errors = 0;
+        semant_class_fingerprints = &fingerprints;
+        root->semant();
+        semant_class_fingerprints = NULL;
+        cool::cerr.rdbuf(saved);
+
+        diagnostics = errors.str();
+        while (!diagnostics.empty() && diagnostics[diagnostics.size() - 1] == '\n') {
+            diagnostics.resize(diagnostics.size() - 1);
+        }
+        skipped_classes = semant_class_table()->skipped_classes;
+        checked_classes = (int) all.size() - skipped_classes;
+        line_index.clear();
+        index_valid = false;
+
+        for (Program block : released) free_binary_ast(block);
+        released.clear();
+    }
+
+    void check_summary(std::string &body) {
+        body += ",\"checked\":" + std::to_string(checked_classes);
+        body += ",\"skipped\":" + std::to_string(skipped_classes);
+        body += ",\"diagnostics\":" + diagnostics;
+    }
+
+    void build_line_index() {
+        std::vector<std::pair<Expression, int> > stack;
+        for (size_t f = 0; f < files.size(); f++) {
+            std::vector<LineEntry> &entries = line_index[files[f].name];
+            for (Class_ c : files[f].classes) {
+                Features features = c->get_features();
+                for (int i = features->first(); features->more(i); i = features->next(i)) {
+                    Feature feature = features->nth(i);
+                    Symbol name;
+                    if (method_class *m = as_method(feature)) {
+                        name = m->get_name();
+                        stack.push_back(std::make_pair(m->get_body(), 0));
+                    } else {
+                        attr_class *a = as_attr(feature);
+                        name = a->get_name();
+                        stack.push_back(std::make_pair(a->get_init(), 0));
+                    }
+                    while (!stack.empty()) {
+                        std::pair<Expression, int> top = stack.back();
+                        stack.pop_back();
+                        if (top.first == NULL) continue;
+                        if (expr_kind(top.first) != EXPR_NO_EXPR) {
+                            LineEntry entry = { top.first->get_line_number(), top.second,
+                                                top.first, c, name };
+                            entries.push_back(entry);
+                        }
+                        push_children(top.first, top.second, stack);
+                    }
+                }
+            }
+            // 同一行内保持先序，即由外到内
+            std::stable_sort(entries.begin(), entries.end(),
+                             [](const LineEntry &a, const LineEntry &b) { return a.line < b.line; });
+        }
+        index_valid = true;
+    }
+
+    void type_at(const Request &request, std::string &body, std::string &error) {
+        std::string name;
+        if (!string_field(request, "file", name, error)) return;
+        const JsonValue *line = field(request, "line");
+        if (line == NULL || line->is_string) {
+            error = "missing \"line\"";
+            return;
+        }
+        if (find_file(name) == NULL) {
+            error = "unknown file " + name;
+            return;
+        }
+        if (!index_valid) build_line_index();
+
+        const std::vector<LineEntry> &entries = line_index[name];
+        LineEntry key = { atoi(line->text.c_str()), 0, NULL, NULL, NULL };
+        auto range = std::equal_range(entries.begin(), entries.end(), key,
+                                      [](const LineEntry &a, const LineEntry &b) { return a.line < b.line; });
+        body += ",\"expressions\":[";
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it != range.first) body += ',';
+            body += "{\"kind\":";
+            json_string(body, expr_kind_names[expr_kind(it->expr)]);
+            body += ",\"type\":";
+            // 未检查的表达式（如继承关系出错的程序）没有类型
+            if (it->expr->get_type() != NULL) json_string(body, it->expr->get_type()->get_string());
+            else body += "null";
+            body += ",\"class\":";
+            json_string(body, it->owner->get_name()->get_string());
+            body += ",\"feature\":";
+            json_string(body, it->feature->get_string());
+            body += ",\"depth\":" + std::to_string(it->depth) + "}";
+        }
+        body += "]";
+    }
+
+    void methods(const Request &request, std::string &body, std::string &error) {
+        std::string name;
+        if (!string_field(request, "type", name, error)) return;
+        ClassTable *table = semant_class_table();
+        Symbol type = idtable.add_string((char *) name.c_str());
+        const std::vector<method_class*> *vtable = table->vtable(type);
+        if (vtable == NULL) {
+            error = "undefined type " + name;
+            return;
+        }
+
+        body += ",\"methods\":[";
+        for (size_t slot = 0; slot < vtable->size(); slot++) {
+            method_class *method = (*vtable)[slot];
+            // 定义该实现的类：沿祖先链上行，直到父类虚表在该位置上不是同一实现
+            Symbol owner = type;
+            for (Class_ c = table->get_class(type); c != NULL; c = table->get_class(c->get_parent())) {
+                const std::vector<method_class*> *parent = table->vtable(c->get_parent());
+                if (parent == NULL || parent->size() <= slot || (*parent)[slot] != method) {
+                    owner = c->get_name();
+                    break;
+                }
+            }
+            if (slot > 0) body += ',';
+            body += "{\"name\":";
+            json_string(body, method->get_name()->get_string());
+            body += ",\"slot\":" + std::to_string(slot) + ",\"formals\":[";
+            Formals formals = method->get_formals();
+            for (int k = formals->first(); formals->more(k); k = formals->next(k)) {
+                if (k != formals->first()) body += ',';
+                body += "{\"name\":";
+                json_string(body, formals->nth(k)->get_name()->get_string());
+                body += ",\"type\":";
+                json_string(body, formals->nth(k)->get_type()->get_string());
+                body += '}';
+            }
+            body += "],\"return\":";
+            json_string(body, method->get_return_type()->get_string());
+            body += ",\"class\":";
+            json_string(body, owner->get_string());
+            body += '}';
+        }
+        body += "]";
+    }
+};
+
+int main(int argc, char *argv[]) {
+    handle_semant_flags(argc, argv);
+    if (argc > 1) {
+        std::cerr << "usage: " << argv[0] << " [semant options]" << std::endl;
+        return 1;
+    }
+    if (semant_cache_file != NULL) {
+        std::cerr << "semant-daemon: --cache is ignored, results are cached in memory" << std::endl;
+        semant_cache_file = NULL;
+    }
+    if (semant_reachable_only) {
+        std::cerr << "semant-daemon: --reachable is ignored" << std::endl;
+        semant_reachable_only = false;
+    }
+    semant_json_diagnostics = true;
+
+    std::unordered_map<std::string, ClassCacheEntry> cache;
+    semant_class_cache = &cache;
+    semant_begin_batch();
+
+    SemantDaemon daemon;
+    std::string line;
+    std::string response;
+    while (std::getline(std::cin, line)) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+        bool running = daemon.handle(line, response);
+        std::cout << response << std::endl;
+        if (!running) break;
+    }
+
+    semant_end_batch();
+    semant_class_cache = NULL;
+    return 0;
+}
@@ -0,0 +1,42 @@
+#ifndef SEMANT_STATS_H
+#define SEMANT_STATS_H
+
+// 语义分析器计数器。只有以 -DSEMANT_STATS 编译时才会计数，
+// 否则 SEMANT_COUNT/SEMANT_ADD 展开为空语句，默认构建没有任何开销。
+// 计数写入线程私有的 semant_thread_stats，由 flush_semant_stats() 合并到全局。
+
+// 表达式种类个数，与 semant.h 中的 EXPR_KIND_COUNT 一致
+const int SEMANT_STATS_EXPR_KINDS = 25;
+
+struct SemantStats {
+    long long expr_checks[SEMANT_STATS_EXPR_KINDS];  // 按表达式种类统计的 type_check_expression 调用
+    long long find_method_calls;
+    long long is_subtype_calls;
+    long long lub_calls;
+    long long lub_steps;             // LCA 查询中沿祖先表走过的步数
+    long long lub_cache_hits;
+    long long lub_cache_misses;
+    long long scope_pushes;
+    long long scope_pops;
+    long long env_lookups;
+    long long env_lookup_steps;      // 变量查找时探测过的哈希槽数
+    long long arena_allocations;
+    long long arena_bytes;           // 从 Arena 分配出的字节数
+    long long arena_block_bytes;     // Arena 向系统申请的字节数
+};
+
+#ifdef SEMANT_STATS
+extern thread_local SemantStats semant_thread_stats;
+#define SEMANT_COUNT(counter) (semant_thread_stats.counter++)
+#define SEMANT_ADD(counter, n) (semant_thread_stats.counter += (n))
+#else
+#define SEMANT_COUNT(counter) ((void) 0)
+#define SEMANT_ADD(counter, n) ((void) 0)
+#endif
+
+// 把当前线程的计数合并到全局并清零（未启用计数时什么也不做）
+void flush_semant_stats();
+// 全局累计的计数
+const SemantStats &semant_stats();
+
+#endif
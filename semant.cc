@@ -1,67 +1,382 @@
 #include "semant.h"
 #include "cool-tree.handcode.h"
+#include "prelude.h"
+#include "thread-pool.h"
+#include <cstddef>
 #include <iostream>
+#include <cstdlib>
+#include <cstring>
 #include <vector>
-#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <chrono>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <typeinfo>
+#include <typeindex>
+#include <new>
+#include <atomic>
 
 // 全局变量定义
 Classes global_classes;
 int semant_errors = 0;
 bool semant_debug = false;
+int semant_jobs = 1;
+const char *semant_cache_file = NULL;
+bool semant_print_stats = false;
+const char *semant_stats_json = NULL;
+int semant_lub_cache_size = 4096;
+bool semant_json_diagnostics = false;
+int semant_max_class_errors = 0;
+bool semant_reachable_only = false;
+std::unordered_map<std::string, ClassCacheEntry> *semant_class_cache = NULL;
+std::unordered_map<Class_, unsigned long long> *semant_class_fingerprints = NULL;
+
+#ifdef SEMANT_STATS
+thread_local SemantStats semant_thread_stats;
+#endif
+static SemantStats global_stats;
+static std::mutex global_stats_lock;
 static ClassTable *class_table = NULL;
+static ClassTable *batch_table = NULL;   // 批处理模式下复用的 ClassTable
+
+// 整个程序的错误，program_class::semant() 结束时一次输出
+static DiagnosticBuffer program_diagnostics;
+static std::vector<DiagnosticNote> diagnostic_notes;   // 附在错误之后输出的说明
+
+static void add_diagnostic_note(const char *kind, const std::string &message) {
+    DiagnosticNote note = { kind, message };
+    diagnostic_notes.push_back(note);
+}
+
+// 并行检查时，当前线程正在检查的类的错误缓冲区；为 NULL 时记入 program_diagnostics
+static thread_local ClassDiagnostics *current_diagnostics = NULL;
+static thread_local DiagnosticStream diagnostic_stream;
+// 当前线程正在做类型检查的类，表达式错误归到这个类
+static thread_local Symbol checking_class = NULL;
+
+// LCA 查询前面的直接映射缓存，每个线程一份；缓存项带有 ClassTable::check()
+// 分配的代号，换一个程序（或另一个 ClassTable）后旧的缓存项自动失效
+namespace {
+struct LubCacheEntry {
+    unsigned generation;
+    int a;
+    int b;
+    int result;
+};
+}
+static thread_local std::vector<LubCacheEntry> lub_cache;
+static std::atomic<unsigned> lub_generations(0);
+
+// 各阶段报告的错误种类
+static const char *diagnostic_kinds[PHASE_COUNT] = {
+    "class", "class", "class", "inheritance", "feature", "type", "type",
+};
+
+// 增量检查时，当前线程正在检查的类所引用的类型；为 NULL 时不记录
+static thread_local std::unordered_set<Symbol> *current_dependencies = NULL;
+
+static inline void note_type(Symbol type) {
+    if (current_dependencies != NULL) current_dependencies->insert(type);
+}
+
+const char *expr_kind_names[EXPR_KIND_COUNT] = {
+    "unknown", "int_const", "bool_const", "string_const", "no_expr", "var",
+    "assign", "dispatch", "static_dispatch", "cond", "loop", "block", "let",
+    "typcase", "new", "isvoid", "plus", "minus", "times", "divide", "lt",
+    "leq", "eq", "comp", "neg",
+};
+
+// 节点种类表：typeid 只需一次虚表读取，查表后用 switch 分派，
+// 避免逐个尝试 dynamic_cast
+ExprKind expr_kind(Expression expr) {
+    static const std::unordered_map<std::type_index, ExprKind> kinds = {
+        { typeid(int_const_class),       EXPR_INT_CONST },
+        { typeid(bool_const_class),      EXPR_BOOL_CONST },
+        { typeid(string_const_class),    EXPR_STRING_CONST },
+        { typeid(no_expr_class),         EXPR_NO_EXPR },
+        { typeid(var_class),             EXPR_VAR },
+        { typeid(assign_class),          EXPR_ASSIGN },
+        { typeid(dispatch_class),        EXPR_DISPATCH },
+        { typeid(static_dispatch_class), EXPR_STATIC_DISPATCH },
+        { typeid(cond_class),            EXPR_COND },
+        { typeid(loop_class),            EXPR_LOOP },
+        { typeid(block_class),           EXPR_BLOCK },
+        { typeid(let_class),             EXPR_LET },
+        { typeid(typcase_class),         EXPR_TYPCASE },
+        { typeid(new__class),            EXPR_NEW },
+        { typeid(isvoid_class),          EXPR_ISVOID },
+        { typeid(plus_class),            EXPR_PLUS },
+        { typeid(minus_class),           EXPR_MINUS },
+        { typeid(times_class),           EXPR_TIMES },
+        { typeid(divide_class),          EXPR_DIVIDE },
+        { typeid(lt_class),              EXPR_LT },
+        { typeid(leq_class),             EXPR_LEQ },
+        { typeid(eq_class),              EXPR_EQ },
+        { typeid(comp_class),            EXPR_COMP },
+        { typeid(neg_class),             EXPR_NEG },
+    };
+    
+    // type_index 的哈希要对类型名逐字计算，按 type_info 地址缓存查表结果
+    struct KindCacheEntry {
+        const std::type_info *type;
+        ExprKind kind;
+    };
+    static thread_local KindCacheEntry cache[64];
+    const std::type_info &type = typeid(*expr);
+    KindCacheEntry &entry = cache[(reinterpret_cast<uintptr_t>(&type) >> 4) & 63];
+    if (entry.type == &type) return entry.kind;
+    
+    auto it = kinds.find(std::type_index(type));
+    entry.type = &type;
+    entry.kind = it != kinds.end() ? it->second : EXPR_UNKNOWN;
+    return entry.kind;
+}
+
+method_class *as_method(Feature f) {
+    return typeid(*f) == typeid(method_class) ? static_cast<method_class*>(f) : NULL;
+}
+
+attr_class *as_attr(Feature f) {
+    return typeid(*f) == typeid(attr_class) ? static_cast<attr_class*>(f) : NULL;
+}
+
+// 取二元算术/比较表达式的左右操作数
+void binary_operands(ExprKind kind, Expression expr, Expression &left, Expression &right) {
+    switch (kind) {
+    case EXPR_PLUS:
+        left = static_cast<plus_class*>(expr)->get_left();
+        right = static_cast<plus_class*>(expr)->get_right();
+        break;
+    case EXPR_MINUS:
+        left = static_cast<minus_class*>(expr)->get_left();
+        right = static_cast<minus_class*>(expr)->get_right();
+        break;
+    case EXPR_TIMES:
+        left = static_cast<times_class*>(expr)->get_left();
+        right = static_cast<times_class*>(expr)->get_right();
+        break;
+    case EXPR_DIVIDE:
+        left = static_cast<divide_class*>(expr)->get_left();
+        right = static_cast<divide_class*>(expr)->get_right();
+        break;
+    case EXPR_LT:
+        left = static_cast<lt_class*>(expr)->get_left();
+        right = static_cast<lt_class*>(expr)->get_right();
+        break;
+    case EXPR_LEQ:
+        left = static_cast<leq_class*>(expr)->get_left();
+        right = static_cast<leq_class*>(expr)->get_right();
+        break;
+    case EXPR_EQ:
+        left = static_cast<eq_class*>(expr)->get_left();
+        right = static_cast<eq_class*>(expr)->get_right();
+        break;
+    default:
+        left = right = NULL;
+        break;
+    }
+}
 
 // 构造函数
-ClassTable::ClassTable(Classes cs) : classes(cs) {
-    semant_errors = 0;
-    class_table = new SymbolTable<Symbol, Class_>();
+ClassTable::ClassTable() : basic_tables_built(false), classes(NULL) {
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        phase_seconds[p] = 0;
+        phase_rss_delta_kb[p] = 0;
+    }
+    for (int k = 0; k < DISPATCH_SHAPE_COUNT; k++) dispatch_shapes[k] = 0;
+    skipped_classes = 0;
+    run_phase(PHASE_INSTALL_BASIC_CLASSES, &ClassTable::install_basic_classes);
+}
+
+ClassTable::ClassTable(Classes cs) : ClassTable() {
+    check(cs);
+}
+
+void ClassTable::check(Classes cs) {
+    classes = cs;
+    registry.truncate(BASIC_CLASS_COUNT);
+    interface_signatures.clear();
+    lub_generation = ++lub_generations;
+    dispatch_log.clear();
+    dispatch_targets.clear();
+    reachable_classes.clear();
+    reachable_methods.clear();
     
-    install_basic_classes();
-    build_inheritance_graph();
-    check_inheritance();
-    type_check();
+    run_phase(PHASE_BUILD_INHERITANCE_GRAPH, &ClassTable::build_inheritance_graph);
+    run_phase(PHASE_BUILD_HIERARCHY_INDEX, &ClassTable::build_hierarchy_index);
+    run_phase(PHASE_CHECK_INHERITANCE, &ClassTable::check_inheritance);
+    run_phase(PHASE_BUILD_METHOD_TABLES, &ClassTable::build_method_tables);
+    run_phase(PHASE_TYPE_CHECK, &ClassTable::type_check);
+    run_phase(PHASE_DEVIRTUALIZE, &ClassTable::devirtualize);
 }
 
-// 安装基本类
+const char *semant_phase_names[PHASE_COUNT] = {
+    "install_basic_classes",
+    "build_inheritance_graph",
+    "build_hierarchy_index",
+    "check_inheritance",
+    "build_method_tables",
+    "type_check",
+    "devirtualize",
+};
+
+const char *dispatch_shape_names[DISPATCH_SHAPE_COUNT] = {
+    "static", "monomorphic", "bimorphic", "megamorphic",
+};
+
+// 进程到目前为止的峰值常驻内存（KB）
+long peak_rss_kb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// 进程当前的常驻内存（KB），取自 /proc/self/statm 的第二项（常驻页数）；读不到时为 0
+long current_rss_kb() {
+    std::ifstream statm("/proc/self/statm");
+    long size = 0, resident = 0;
+    if (!(statm >> size >> resident)) return 0;
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// 执行一个阶段并记录耗时和阶段前后常驻内存的增量。峰值（ru_maxrss）是整个
+// 进程的历史最大值，前面的阶段或上一个程序已经达到时反映不出本阶段的用量
+void ClassTable::run_phase(SemantPhase phase, void (ClassTable::*step)()) {
+    current_phase = phase;
+    long rss_before = current_rss_kb();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    (this->*step)();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    phase_seconds[phase] = elapsed.count();
+    phase_rss_delta_kb[phase] = current_rss_kb() - rss_before;
+}
+
+static_assert(BUILTIN_CLASS_COUNT == BASIC_CLASS_COUNT, "prelude.h 中基本类的个数需与 BASIC_CLASS_COUNT 一致");
+
+// 基本类的 AST：整个进程只建一次，所有 ClassTable 共用（类型检查不修改基本类）。
+// 结点用 placement new 建在静态存储中，不做堆分配，所需大小在编译期由 prelude.h 算出
+struct BuiltinPrelude {
+    Class_ classes[BUILTIN_CLASS_COUNT];
+    method_class *methods[BUILTIN_CLASS_COUNT][BUILTIN_MAX_METHODS];
+    attr_class *attrs[BUILTIN_CLASS_COUNT][BUILTIN_MAX_ATTRS];
+};
+
+// 每个对象按最大对齐取整（与 ast-binary.cc 的读入相同）
+static constexpr size_t prelude_object_size(size_t size) {
+    return (size + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+}
+
+template <class Elem>
+static constexpr size_t prelude_list_size(int count) {
+    return count == 0 ? prelude_object_size(sizeof(nil_node<Elem>))
+                      : count * prelude_object_size(sizeof(single_list_node<Elem>)) +
+                        (count - 1) * prelude_object_size(sizeof(append_node<Elem>));
+}
+
+static constexpr size_t prelude_storage_size() {
+    size_t size = 0;
+    for (int c = 0; c < BUILTIN_CLASS_COUNT; c++) {
+        const BuiltinClass &cls = builtin_classes[c];
+        size += prelude_object_size(sizeof(class__class));
+        size += prelude_list_size<Feature>(cls.method_count + cls.attr_count);
+        for (int m = 0; m < cls.method_count; m++) {
+            int formals = cls.methods[m].formal_count;
+            size += prelude_object_size(sizeof(method_class)) + prelude_object_size(sizeof(no_expr_class));
+            size += prelude_list_size<Formal>(formals) + formals * prelude_object_size(sizeof(formal_class));
+        }
+        size += cls.attr_count * (prelude_object_size(sizeof(attr_class)) + prelude_object_size(sizeof(no_expr_class)));
+    }
+    return size;
+}
+
+class PreludeBuilder {
+public:
+    explicit PreludeBuilder(unsigned char *storage) : cursor(storage) {}
+    
+    void build(BuiltinPrelude &prelude) {
+        int saved_lineno = node_lineno;
+        node_lineno = 0;
+        for (int c = 0; c < BUILTIN_CLASS_COUNT; c++) {
+            const BuiltinClass &cls = builtin_classes[c];
+            Feature features[BUILTIN_MAX_METHODS + BUILTIN_MAX_ATTRS];
+            int count = 0;
+            for (int m = 0; m < cls.method_count; m++) {
+                const BuiltinMethod &spec = cls.methods[m];
+                Formal formals[2];
+                for (int k = 0; k < spec.formal_count; k++) {
+                    formals[k] = make<formal_class>(id(spec.formals[k].name), id(spec.formals[k].type));
+                }
+                method_class *method = make<method_class>(id(spec.name), list<Formal>(formals, spec.formal_count),
+                                                          id(spec.return_type), make<no_expr_class>());
+                prelude.methods[c][m] = method;
+                features[count++] = method;
+            }
+            for (int a = 0; a < cls.attr_count; a++) {
+                attr_class *attr = make<attr_class>(id(cls.attrs[a].name), id(cls.attrs[a].type),
+                                                    make<no_expr_class>());
+                prelude.attrs[c][a] = attr;
+                features[count++] = attr;
+            }
+            Symbol parent = cls.parent >= 0 ? id(builtin_classes[cls.parent].name) : No_class;
+            prelude.classes[c] = make<class__class>(id(cls.name), parent, list<Feature>(features, count), String);
+        }
+        node_lineno = saved_lineno;
+    }
+    
+private:
+    unsigned char *cursor;
+    
+    static Symbol id(const char *name) {
+        return idtable.add_string((char *) name);
+    }
+    
+    template <class T, class... Args>
+    T *make(Args... args) {
+        void *p = cursor;
+        cursor += prelude_object_size(sizeof(T));
+        return new (p) T(args...);
+    }
+    
+    template <class Elem>
+    list_node<Elem> *list(Elem *items, int count) {
+        if (count == 0) return make<nil_node<Elem> >();
+        list_node<Elem> *l = make<single_list_node<Elem> >(items[0]);
+        for (int i = 1; i < count; i++) {
+            l = make<append_node<Elem> >(l, make<single_list_node<Elem> >(items[i]));
+        }
+        return l;
+    }
+};
+
+static BuiltinPrelude build_builtin_prelude() {
+    alignas(std::max_align_t) static unsigned char storage[prelude_storage_size()];
+    BuiltinPrelude prelude;
+    PreludeBuilder(storage).build(prelude);
+    return prelude;
+}
+
+static const BuiltinPrelude &builtin_prelude() {
+    static const BuiltinPrelude prelude = build_builtin_prelude();
+    return prelude;
+}
+
+// 安装基本类，按 Object、IO、Int、Bool、String 的顺序占用 0..4 号
 void ClassTable::install_basic_classes() {
-    // Object 类
-    Object_class = class_(Object, 
-                         No_class,
-                         append_Features(new Features(0),
-                         append_Features(new Features(0),
-                         new Features(0))),
-                         String, No_class);
-    class_table->addid(Object, &Object_class);
-    
-    // IO 类
-    IO_class = class_(IO,
-                     Object,
-                     append_Features(new Features(0),
-                     append_Features(new Features(0),
-                     new Features(0))),
-                     String, No_class);
-    class_table->addid(IO, &IO_class);
-    
-    // Int 类
-    Int_class = class_(Int,
-                      Object,
-                      new Features(0),
-                      String, No_class);
-    class_table->addid(Int, &Int_class);
-    
-    // Bool 类  
-    Bool_class = class_(Bool,
-                       Object,
-                       new Features(0),
-                       String, No_class);
-    class_table->addid(Bool, &Bool_class);
-    
-    // String 类
-    String_class = class_(Str,
-                         Object,
-                         append_Features(new Features(0),
-                         new Features(0)),
-                         String, No_class);
-    class_table->addid(Str, &String_class);
+    const BuiltinPrelude &prelude = builtin_prelude();
+    for (int c = 0; c < BASIC_CLASS_COUNT; c++) {
+        registry.add(prelude.classes[c]->get_name(), prelude.classes[c]);
+    }
+    Object_class = prelude.classes[0];
+    IO_class = prelude.classes[1];
+    Int_class = prelude.classes[2];
+    Bool_class = prelude.classes[3];
+    Str_class = prelude.classes[4];
 }
 
 // 构建继承图
@@ -70,601 +385,1722 @@ void ClassTable::build_inheritance_graph() {
         Class_ c = classes->nth(i);
         Symbol name = c->get_name();
         
-        // 检查是否已定义
-        if (class_table->probe(name) != NULL) {
+        // 注册并分配类编号，已定义的类名注册失败
+        if (registry.add(name, c) < 0) {
             semant_error(c) << "Class " << name << " was previously defined." << endl;
+        }
+    }
+}
+
+// 构建继承树索引
+void ClassTable::build_hierarchy_index() {
+    // 类编号在注册时已分配：基本类占用 0..4 号，用户类按源码顺序编号
+    int n = registry.size();
+    parent_ids.assign(n, -1);
+    child_begin.assign(n + 1, 0);
+    for (int v = 0; v < n; v++) {
+        Symbol parent = registry.get(v)->get_parent();
+        int p = parent != No_class ? class_id(parent) : -1;
+        if (p >= 0) {
+            parent_ids[v] = p;
+            child_begin[p + 1]++;
+        }
+    }
+    
+    // 子类列表按父类编号连续存放（CSR）：child_list[child_begin[p] .. child_begin[p+1])
+    for (int v = 0; v < n; v++) child_begin[v + 1] += child_begin[v];
+    child_list.assign(child_begin[n], 0);
+    std::vector<int> fill(child_begin.begin(), child_begin.end() - 1);
+    for (int v = 0; v < n; v++) {
+        if (parent_ids[v] >= 0) child_list[fill[parent_ids[v]]++] = v;
+    }
+    
+    // 从 Object 出发的非递归 DFS；继承环上或父类未定义的类不会被访问到，
+    // 它们的 pre_order 保持为 -1
+    pre_order.assign(n, -1);
+    post_order.assign(n, -1);
+    depths.assign(n, 0);
+    int counter = 0;
+    int max_depth = 0;
+    int root = class_id(Object);
+    std::vector<std::pair<int, int> > stack;
+    pre_order[root] = counter++;
+    stack.push_back(std::make_pair(root, child_begin[root]));
+    while (!stack.empty()) {
+        int v = stack.back().first;
+        int next = stack.back().second;
+        if (next < child_begin[v + 1]) {
+            stack.back().second++;
+            int c = child_list[next];
+            depths[c] = depths[v] + 1;
+            if (depths[c] > max_depth) max_depth = depths[c];
+            pre_order[c] = counter++;
+            stack.push_back(std::make_pair(c, child_begin[c]));
         } else {
-            // 使用 new 分配内存，避免悬空指针
-            Class_ *class_ptr = new Class_(c);
-            class_table->addid(name, class_ptr);
+            post_order[v] = counter++;
+            stack.pop_back();
+        }
+    }
+    
+    // 倍增祖先表，根节点的祖先指向自己
+    ancestor_levels = 1;
+    while ((1 << ancestor_levels) <= max_depth) ancestor_levels++;
+    ancestors.assign(ancestor_levels * n, 0);
+    for (int v = 0; v < n; v++) {
+        ancestors[v] = parent_ids[v] >= 0 ? parent_ids[v] : v;
+    }
+    for (int k = 1; k < ancestor_levels; k++) {
+        int *level = &ancestors[k * n];
+        const int *below = &ancestors[(k - 1) * n];
+        for (int v = 0; v < n; v++) {
+            level[v] = below[below[v]];
         }
     }
 }
 
-// 检查继承关系
+// 检查继承关系：在稠密的父类编号数组上一遍完成，
+// 同时检查继承基本类、父类未定义和继承环
 void ClassTable::check_inheritance() {
-    // 检查基本类型的继承限制
-    for (int i = classes->first(); classes->more(i); i = classes->next(i)) {
-        Class_ c = classes->nth(i);
-        Symbol name = c->get_name();
-        Symbol parent = c->get_parent();
+    int n = registry.size();
+    
+    // 沿父类链着色：0 未访问，1 在当前路径上，2 已完成。
+    // in_cycle 标记位于环上或祖先位于环上的类
+    std::vector<char> color(n, 0);
+    std::vector<char> in_cycle(n, 0);
+    std::vector<int> path;
+    for (int v = 0; v < n; v++) {
+        if (color[v] != 0) continue;
         
-        if (parent == Int || parent == Bool || parent == Str || parent == SELF_TYPE) {
-            semant_error(c) << "Class " << name << " cannot inherit from basic class " << parent << endl;
+        path.clear();
+        int u = v;
+        while (u >= 0 && color[u] == 0) {
+            color[u] = 1;
+            path.push_back(u);
+            u = parent_ids[u];
+        }
+        
+        // 停在当前路径上的节点说明找到了环；停在已完成的节点上则继承其结果
+        bool bad = u >= 0 && (color[u] == 1 || in_cycle[u]);
+        for (int i = path.size() - 1; i >= 0; i--) {
+            color[path[i]] = 2;
+            in_cycle[path[i]] = bad;
         }
     }
     
-    // 检查继承循环
-    for (int i = classes->first(); classes->more(i); i = classes->next(i)) {
-        Class_ c = classes->nth(i);
+    // 按源码顺序报告（用户类的编号即源码顺序）
+    for (int v = BASIC_CLASS_COUNT; v < n; v++) {
+        Class_ c = registry.get(v);
         Symbol name = c->get_name();
         Symbol parent = c->get_parent();
         
-        if (parent != No_class) {
-            Symbol current = name;
-            std::set<Symbol> visited;
-            visited.insert(current);
-            
-            Symbol ancestor = parent;
-            while (ancestor != No_class) {
-                if (visited.find(ancestor) != visited.end()) {
-                    semant_error(c) << "Class " << name 
-                                   << ", or an ancestor of " << name 
-                                   << ", is involved in an inheritance cycle." << endl;
-                    break;
-                }
-                visited.insert(ancestor);
-                
-                Class_ *ancestor_class_ptr = class_table->lookup(ancestor);
-                if (ancestor_class_ptr == NULL) break;
-                Class_ ancestor_class = *ancestor_class_ptr;
-                ancestor = ancestor_class->get_parent();
-            }
+        if (parent == Int || parent == Bool || parent == Str || parent == SELF_TYPE) {
+            semant_error(c) << "Class " << name << " cannot inherit from basic class " << parent << endl;
+        } else if (parent_ids[v] < 0) {
+            semant_error(c) << "Class " << name << " inherits from an undefined class " << parent << "." << endl;
+        } else if (in_cycle[v]) {
+            semant_error(c) << "Class " << name 
+                           << ", or an ancestor of " << name 
+                           << ", is involved in an inheritance cycle." << endl;
         }
     }
 }
 
+// 把缓存中记录的一个类的错误放回它的缓冲区
+static void replay_cached_errors(Class_ c, const ClassCacheEntry &entry, ClassDiagnostics &result) {
+    const char *filename = c->get_filename()->get_string();
+    std::istringstream lines(entry.errors);
+    std::string line;
+    while (std::getline(lines, line)) {
+        std::istringstream fields(line);
+        int form = DIAG_PLAIN;
+        int lineno = 0;
+        fields >> form >> lineno;
+        fields.get();
+        std::string message;
+        std::getline(fields, message);
+        result.diagnostics.add((DiagnosticForm) form, filename, lineno, c->get_name(),
+                               diagnostic_kinds[PHASE_TYPE_CHECK], message.data(), message.size());
+    }
+    result.count = entry.error_count;
+}
+
+// 类的指纹：常驻进程已算好的直接取用，否则重新计算
+static unsigned long long known_fingerprint(Class_ c) {
+    if (semant_class_fingerprints != NULL) {
+        auto it = semant_class_fingerprints->find(c);
+        if (it != semant_class_fingerprints->end()) return it->second;
+    }
+    return ClassTable::class_fingerprint(c);
+}
+
 // 类型检查主函数
 void ClassTable::type_check() {
-    // 对每个类进行类型检查
+    std::vector<Class_> to_check;
     for (int i = classes->first(); classes->more(i); i = classes->next(i)) {
-        Class_ c = classes->nth(i);
-        Symbol class_name = c->get_name();
-        
-        // 检查方法重写
-        check_method_override(c);
-        
-        // 检查特性
-        Features features = c->get_features();
-        for (int j = features->first(); features->more(j); j = features->next(j)) {
-            Feature f = features->nth(j);
-            
-            if (auto attr = dynamic_cast<attr_class*>(f)) {
-                // 属性类型检查
-                Symbol attr_type = attr->get_type();
-                if (attr_type == SELF_TYPE) {
-                    semant_error(c) << "Attribute " << attr->get_name() 
-                                   << " cannot have type SELF_TYPE" << endl;
-                }
-            } else if (auto method = dynamic_cast<method_class*>(f)) {
-                // 方法类型检查
-                Symbol return_type = method->get_return_type();
-                Expression body = method->get_body();
-                
-                // 创建对象环境（包含self和参数）
-                SymbolTable<Symbol, Symbol> *object_env = new SymbolTable<Symbol, Symbol>();
-                object_env->enterscope();
-                
-                // 添加self变量，类型为SELF_TYPE
-                object_env->addid(self, new Symbol(SELF_TYPE));
-                
-                // 添加方法参数到环境
-                Formals formals = method->get_formals();
-                for (int k = formals->first(); formals->more(k); k = formals->next(k)) {
-                    Formal formal = formals->nth(k);
-                    object_env->addid(formal->get_name(), new Symbol(formal->get_type()));
-                }
-                
-                // 检查方法体类型
-                Symbol body_type = type_check_expression(body, class_name, object_env, "");
-                
-                // 清理环境
-                delete object_env;
-                
-                // 检查返回类型兼容性
-                if (return_type == SELF_TYPE) {
-                    if (body_type != SELF_TYPE) {
-                        semant_error(c) << "Method " << method->get_name() 
-                                       << " has return type SELF_TYPE but returns " << body_type << endl;
-                    }
-                } else {
-                    if (!is_subtype(body_type, return_type)) {
-                        semant_error(c) << "Method " << method->get_name() 
-                                       << " returns " << body_type 
-                                       << " but should return " << return_type << endl;
-                    }
-                }
-            }
+        to_check.push_back(classes->nth(i));
+    }
+    
+    bool incremental = semant_cache_file != NULL || semant_class_cache != NULL;
+    skipped_classes = 0;
+    if (semant_reachable_only && !incremental && type_check_reachable(to_check)) return;
+    if (!incremental && (semant_jobs <= 1 || to_check.size() < 2)) {
+        for (Class_ c : to_check) {
+            type_check_class(c, env_arena);
         }
+        return;
     }
-}
-
-// 表达式类型检查
-Symbol ClassTable::type_check_expression(Expression expr, Symbol current_class, 
-                                        SymbolTable<Symbol, Symbol> *&object_env, 
-                                        const char *filename) {
-    if (auto int_const = dynamic_cast<int_const_class*>(expr)) {
-        return Int;
+    
+    // 各类的错误先写入自己的缓冲区，全部完成后按源码顺序输出，
+    // 与串行检查的输出完全一致
+    std::vector<ClassDiagnostics> results(to_check.size());
+    
+    // 增量检查：指纹和依赖签名都未变化的类直接复用缓存中的结果
+    std::unordered_map<std::string, ClassCacheEntry> file_cache;
+    std::unordered_map<std::string, ClassCacheEntry> &cache =
+        semant_class_cache != NULL ? *semant_class_cache : file_cache;
+    std::vector<unsigned long long> fingerprints(to_check.size());
+    std::vector<char> up_to_date(to_check.size(), 0);
+    int skipped = 0;
+    if (incremental) {
+        if (semant_class_cache == NULL) load_class_cache(semant_cache_file, cache);
+        for (size_t i = 0; i < to_check.size(); i++) {
+            fingerprints[i] = known_fingerprint(to_check[i]);
+            auto it = cache.find(to_check[i]->get_name()->get_string());
+            if (it != cache.end() && cache_entry_valid(it->second, fingerprints[i])) {
+                replay_cached_errors(to_check[i], it->second, results[i]);
+                up_to_date[i] = 1;
+                skipped++;
+            }
+        }
     }
-    else if (auto bool_const = dynamic_cast<bool_const_class*>(expr)) {
-        return Bool;
+    
+    std::vector<Arena> arenas(semant_jobs);
+    parallel_for(to_check.size(), semant_jobs, [&](size_t i, int worker) {
+        if (up_to_date[i]) return;
+        current_diagnostics = &results[i];
+        if (incremental) {
+            current_dependencies = &results[i].dependencies;
+            note_type(to_check[i]->get_name());
+            note_type(to_check[i]->get_parent());
+        }
+        type_check_class(to_check[i], arenas[worker]);
+        diagnostic_stream.commit();
+        current_diagnostics = NULL;
+        current_dependencies = NULL;
+        flush_semant_stats();
+    });
+    
+    for (size_t i = 0; i < results.size(); i++) {
+        ::semant_errors += program_diagnostics.append(results[i].diagnostics);
+        dispatch_log.insert(dispatch_log.end(), results[i].dispatches.begin(), results[i].dispatches.end());
     }
-    else if (auto string_const = dynamic_cast<string_const_class*>(expr)) {
-        return Str;
+    
+    if (incremental) {
+        for (size_t i = 0; i < to_check.size(); i++) {
+            if (up_to_date[i]) continue;
+            ClassCacheEntry &entry = cache[to_check[i]->get_name()->get_string()];
+            entry.fingerprint = fingerprints[i];
+            entry.error_count = results[i].count;
+            entry.errors.clear();
+            const DiagnosticBuffer &errors = results[i].diagnostics;
+            for (size_t k = 0; k < errors.size(); k++) {
+                entry.errors += std::to_string((int) errors[k].form) + " " + std::to_string(errors[k].line) + " ";
+                entry.errors.append(errors.message(errors[k]), errors[k].length);
+                entry.errors += '\n';
+            }
+            entry.deps.clear();
+            for (Symbol dep : results[i].dependencies) {
+                entry.deps.push_back(std::make_pair(std::string(dep->get_string()),
+                                                    interface_signature(dep)));
+            }
+        }
+        if (semant_class_cache == NULL) save_class_cache(semant_cache_file, cache);
+        skipped_classes = skipped;
+        add_diagnostic_note("incremental", "Incremental: " + std::to_string(skipped) + " of " +
+                                           std::to_string(to_check.size()) + " classes up to date, skipped.");
     }
-    else if (auto var = dynamic_cast<var_class*>(expr)) {
-        // 变量查找
-        Symbol *type_ptr = object_env->lookup(var->get_name());
-        if (type_ptr == NULL) {
-            semant_error(filename, expr) << "Undefined variable " << var->get_name() << endl;
-            return Object;
+}
+
+// 可达性检查：从 Main.main 出发，检查方法体时记下其中引用到的类型（new、let、case、
+// 静态调用、形参和返回类型等）和解析出的调用，把新可达的类和方法加入工作表，
+// 直到不再有新的方法。动态调用按类层次分析取接收者子树中该虚表位置上的全部实现。
+// 类可达时连同祖先一起检查属性初始化表达式（构造对象时都会执行）。
+// 继承关系在此之前已对全部类检查过。没有 Main.main 时返回 false，退回全量检查
+bool ClassTable::type_check_reachable(const std::vector<Class_> &to_check) {
+    static Symbol main_method = idtable.add_string((char *) "main");
+    int n = registry.size();
+    int main_id = class_id(Main);
+    const MethodSlot *entry = main_id >= 0 && pre_order[main_id] >= 0
+                              ? find_method_slot(Main, main_method) : NULL;
+    if (entry == NULL) return false;
+    
+    std::unordered_map<method_class*, int> owners;
+    for (int v = BASIC_CLASS_COUNT; v < n; v++) {
+        Features features = registry.get(v)->get_features();
+        for (int i = features->first(); features->more(i); i = features->next(i)) {
+            if (method_class *m = as_method(features->nth(i))) owners.insert(std::make_pair(m, v));
         }
-        return *type_ptr;
     }
-    else if (auto assign = dynamic_cast<assign_class*>(expr)) {
-        // 赋值表达式
-        Symbol var_name = assign->get_name();
-        Symbol *var_type_ptr = object_env->lookup(var_name);
-        
-        if (var_type_ptr == NULL) {
-            semant_error(filename, expr) << "Assignment to undefined variable " << var_name << endl;
-            return Object;
+    
+    // pending[v]：类 v 中已可达、尚未检查的特性；queue 中是有待检查特性的类
+    reachable_classes.assign(n, 0);
+    std::vector<std::vector<Feature> > pending(n);
+    std::vector<int> queue;
+    std::vector<ClassDiagnostics> results(n);
+    // 每个特性的错误在 results 中的范围 [begin, end)，最后按特性的源码顺序输出
+    std::unordered_map<Feature, std::pair<size_t, size_t> > spans;
+    std::vector<size_t> ends;
+    std::unordered_set<Symbol> referenced;
+    std::unordered_set<long long> expanded;   // 已展开过的（接收者类，虚表位置）
+    std::vector<int> stack;
+    
+    auto enqueue = [&](int v, Feature f) {
+        if (v < BASIC_CLASS_COUNT) return;   // 基本类不做类型检查
+        if (pending[v].empty()) queue.push_back(v);
+        pending[v].push_back(f);
+    };
+    auto reach_class = [&](int v) {
+        for (; v >= 0 && !reachable_classes[v]; v = parent_ids[v]) {
+            reachable_classes[v] = 1;
+            if (v < BASIC_CLASS_COUNT) continue;
+            Features features = registry.get(v)->get_features();
+            for (int i = features->first(); features->more(i); i = features->next(i)) {
+                if (as_attr(features->nth(i)) != NULL) enqueue(v, features->nth(i));
+            }
         }
+    };
+    auto reach_method = [&](method_class *m) {
+        if (!reachable_methods.insert(m).second) return;
+        auto owner = owners.find(m);
+        if (owner == owners.end()) return;   // 基本类的方法
+        reach_class(owner->second);
+        enqueue(owner->second, m);
+    };
+    
+    reach_class(main_id);
+    reach_method(entry->method);
+    while (!queue.empty()) {
+        int v = queue.back();
+        queue.pop_back();
+        std::vector<Feature> features;
+        features.swap(pending[v]);
         
-        Symbol var_type = *var_type_ptr;
-        Symbol expr_type = type_check_expression(assign->get_expr(), current_class, object_env, filename);
-        
-        if (!is_subtype(expr_type, var_type)) {
-            semant_error(filename, expr) << "Type " << expr_type 
-                                       << " is not subtype of " << var_type << endl;
+        ClassDiagnostics &result = results[v];
+        size_t first_dispatch = result.dispatches.size();
+        size_t begin = result.diagnostics.size();
+        current_diagnostics = &result;
+        current_dependencies = &referenced;
+        ends.clear();
+        type_check_class(registry.get(v), env_arena, &features, &ends);
+        current_diagnostics = NULL;
+        current_dependencies = NULL;
+        for (size_t k = 0; k < features.size(); k++) {
+            spans[features[k]] = std::make_pair(k == 0 ? begin : ends[k - 1], ends[k]);
         }
         
-        return expr_type;
-    }
-    else if (auto dispatch = dynamic_cast<dispatch_class*>(expr)) {
-        // 方法调用
-        Symbol expr_type = current_class;  // 默认是self
+        for (Symbol type : referenced) {
+            int id = class_id(type);
+            if (id >= 0) reach_class(id);
+        }
+        referenced.clear();
         
-        if (dispatch->get_expr() != nullptr) {
-            expr_type = type_check_expression(dispatch->get_expr(), current_class, object_env, filename);
-            // 处理SELF_TYPE
-            if (expr_type == SELF_TYPE) {
-                expr_type = current_class;
+        for (size_t i = first_dispatch; i < result.dispatches.size(); i++) {
+            const DispatchSite &site = result.dispatches[i];
+            int r = class_id(site.receiver);
+            if (typeid(*site.expr) == typeid(static_dispatch_class) || r < 0 || pre_order[r] < 0) {
+                reach_method(site.target.method);
+                continue;
+            }
+            int slot = site.target.slot;
+            if (!expanded.insert((long long) r * n + slot).second) continue;
+            stack.assign(1, r);
+            while (!stack.empty()) {
+                int c = stack.back();
+                stack.pop_back();
+                reach_method(vtables[c][slot]);
+                for (int k = child_begin[c]; k < child_begin[c + 1]; k++) stack.push_back(child_list[k]);
             }
         }
-        
-        Symbol method_name = dispatch->get_name();
-        method_class *method = find_method(expr_type, method_name);
-        
-        if (method == NULL) {
-            semant_error(filename, expr) << "Dispatch to undefined method " << method_name << endl;
-            return Object;
+    }
+    
+    // 错误按类的源码顺序、类中按特性的源码顺序输出（与全量检查相同），
+    // 不受工作表中检查先后的影响
+    for (int v = BASIC_CLASS_COUNT; v < n; v++) {
+        Features features = registry.get(v)->get_features();
+        for (int i = features->first(); features->more(i); i = features->next(i)) {
+            auto span = spans.find(features->nth(i));
+            if (span == spans.end()) continue;
+            ::semant_errors += program_diagnostics.append(results[v].diagnostics,
+                                                          span->second.first, span->second.second);
         }
-        
-        // 检查参数
-        Expressions actuals = dispatch->get_actuals();
-        Formals formals = method->get_formals();
-        
-        if (actuals->len() != formals->len()) {
-            semant_error(filename, expr) << "Method " << method_name 
-                                       << " called with wrong number of arguments" << endl;
+        dispatch_log.insert(dispatch_log.end(), results[v].dispatches.begin(), results[v].dispatches.end());
+    }
+    
+    // 报告被裁剪的类和方法（重复定义而未注册的类不计）
+    int classes_checked = 0, classes_total = 0, methods_total = 0;
+    std::string pruned_classes, pruned_methods;
+    for (Class_ c : to_check) {
+        int v = class_id(c->get_name());
+        if (v < 0 || registry.get(v) != c) continue;
+        classes_total++;
+        if (reachable_classes[v]) {
+            classes_checked++;
         } else {
-            for (int i = actuals->first(), j = formals->first(); 
-                 actuals->more(i) && formals->more(j); 
-                 i = actuals->next(i), j = formals->next(j)) {
-                Expression actual = actuals->nth(i);
-                Formal formal = formals->nth(j);
-                
-                Symbol actual_type = type_check_expression(actual, current_class, object_env, filename);
-                Symbol formal_type = formal->get_type();
-                
-                if (!is_subtype(actual_type, formal_type)) {
-                    semant_error(filename, actual) << "Actual type " << actual_type 
-                                                  << " does not match formal type " << formal_type << endl;
-                }
-            }
+            pruned_classes += pruned_classes.empty() ? " " : ", ";
+            pruned_classes += c->get_name()->get_string();
         }
-        
-        // 处理方法返回类型
-        Symbol result_type = method->get_return_type();
-        Symbol original_expr_type = expr_type;  // 保存原始类型用于SELF_TYPE处理
-        
-        if (result_type == SELF_TYPE) {
-            if (dispatch->get_expr() != nullptr && 
-                type_check_expression(dispatch->get_expr(), current_class, object_env, filename) == SELF_TYPE) {
-                result_type = SELF_TYPE;
-            } else {
-                result_type = current_class;
+        Features features = c->get_features();
+        for (int i = features->first(); features->more(i); i = features->next(i)) {
+            method_class *m = as_method(features->nth(i));
+            if (m == NULL) continue;
+            methods_total++;
+            if (reachable_methods.count(m) > 0) continue;
+            pruned_methods += pruned_methods.empty() ? " " : ", ";
+            pruned_methods += c->get_name()->get_string();
+            pruned_methods += '.';
+            pruned_methods += m->get_name()->get_string();
+        }
+    }
+    int methods_checked = 0;
+    for (method_class *m : reachable_methods) methods_checked += owners.count(m);
+    add_diagnostic_note("reachable", "Reachable from Main.main: " + std::to_string(classes_checked) + " of " +
+                                     std::to_string(classes_total) +
+                                     " classes, " + std::to_string(methods_checked) + " of " +
+                                     std::to_string(methods_total) + " methods checked.");
+    if (!pruned_classes.empty()) add_diagnostic_note("reachable", "Pruned classes:" + pruned_classes);
+    if (!pruned_methods.empty()) add_diagnostic_note("reachable", "Pruned methods:" + pruned_methods);
+    return true;
+}
+
+bool ClassTable::is_reachable(Symbol class_name) {
+    int id = class_id(class_name);
+    return reachable_classes.empty() || (id >= 0 && reachable_classes[id]);
+}
+
+bool ClassTable::is_reachable(method_class *method) {
+    return reachable_classes.empty() || reachable_methods.count(method) > 0;
+}
+
+// 检查一个类的所有特性，对象环境的内存取自 arena
+void ClassTable::type_check_class(Class_ c, Arena &arena, const std::vector<Feature> *selected,
+                                  std::vector<size_t> *ends) {
+    Symbol class_name = c->get_name();
+    const char *filename = c->get_filename()->get_string();
+    ObjectEnv object_env(arena);
+    checking_class = class_name;
+    
+    // 类作用域：self 和全部属性（含继承的属性，取自自顶向下建好的属性表），
+    // 本类所有方法体和属性初始化表达式共用，每个方法只在其上压一层参数作用域
+    note_type(class_name);
+    object_env.enterscope();
+    object_env.addid(self, SELF_TYPE);
+    int id = class_id(class_name);
+    if (id >= 0 && registry.get(id) == c) {
+        for (auto &entry : attr_tables[id]) {
+            object_env.addid(entry.first, entry.second->get_type());
+        }
+    }
+    
+    // 检查特性（给出 selected 时只检查其中的特性，给出 ends 时记下每个特性检查完后
+    // current_diagnostics 中的错误条数）
+    if (selected != NULL) {
+        for (Feature f : *selected) {
+            type_check_feature(c, f, object_env, filename);
+            if (ends != NULL) {
+                diagnostic_stream.commit();
+                ends->push_back(current_diagnostics->diagnostics.size());
             }
         }
-        
-        return result_type;
+    } else {
+        Features features = c->get_features();
+        for (int j = features->first(); features->more(j); j = features->next(j)) {
+            type_check_feature(c, features->nth(j), object_env, filename);
+        }
     }
-    else if (auto cond = dynamic_cast<cond_class*>(expr)) {
-        // 条件表达式
-        Symbol pred_type = type_check_expression(cond->get_pred(), current_class, object_env, filename);
-        if (pred_type != Bool) {
-            semant_error(filename, cond->get_pred()) << "Predicate of 'if' must have type Bool" << endl;
+    
+    // 本类的对象环境不再使用，Arena 回到起点供下一个类复用
+    checking_class = NULL;
+    object_env.release();
+    arena.reset();
+}
+
+// 在类作用域中检查一个属性初始化表达式或方法体
+void ClassTable::type_check_feature(Class_ c, Feature f, ObjectEnv &object_env, const char *filename) {
+    Symbol class_name = c->get_name();
+    if (auto attr = as_attr(f)) {
+        // 属性类型检查
+        Symbol attr_type = attr->get_type();
+        note_type(attr_type);
+        if (attr_type == SELF_TYPE) {
+            semant_error(c) << "Attribute " << attr->get_name() 
+                           << " cannot have type SELF_TYPE" << endl;
         }
         
-        Symbol then_type = type_check_expression(cond->get_then_exp(), current_class, object_env, filename);
-        Symbol else_type = type_check_expression(cond->get_else_exp(), current_class, object_env, filename);
+        // 初始化表达式在类作用域中检查
+        Symbol init_type = type_check_expression(attr->get_init(), class_name, object_env, filename);
+        if (!is_subtype(init_type, attr_type)) {
+            semant_error(c) << "Inferred type " << init_type 
+                           << " of initialization of attribute " << attr->get_name()
+                           << " does not conform to declared type " << attr_type << endl;
+        }
+    } else if (auto method = as_method(f)) {
+        // 方法类型检查
+        Symbol return_type = method->get_return_type();
+        Expression body = method->get_body();
+        note_type(return_type);
         
-        return lub(then_type, else_type);
-    }
-    else if (auto loop = dynamic_cast<loop_class*>(expr)) {
-        // 循环表达式
-        Symbol pred_type = type_check_expression(loop->get_pred(), current_class, object_env, filename);
-        if (pred_type != Bool) {
-            semant_error(filename, loop->get_pred()) << "Predicate of 'while' must have type Bool" << endl;
+        // 参数作用域（参数可以遮蔽同名属性）
+        object_env.enterscope();
+        Formals formals = method->get_formals();
+        for (int k = formals->first(); formals->more(k); k = formals->next(k)) {
+            Formal formal = formals->nth(k);
+            object_env.addid(formal->get_name(), formal->get_type());
+            note_type(formal->get_type());
         }
         
-        type_check_expression(loop->get_body(), current_class, object_env, filename);
-        return Object;  // while循环返回Object
-    }
-    else if (auto block = dynamic_cast<block_class*>(expr)) {
-        // 块表达式
-        Symbol result_type = No_type;
-        Expressions body = block->get_body();
+        // 检查方法体类型
+        Symbol body_type = type_check_expression(body, class_name, object_env, filename);
+        object_env.exitscope();
         
-        for (int i = body->first(); body->more(i); i = body->next(i)) {
-            Expression e = body->nth(i);
-            result_type = type_check_expression(e, current_class, object_env, filename);
+        // 检查返回类型兼容性
+        if (return_type == SELF_TYPE) {
+            if (body_type != SELF_TYPE) {
+                semant_error(c) << "Method " << method->get_name() 
+                               << " has return type SELF_TYPE but returns " << body_type << endl;
+            }
+        } else {
+            if (!is_subtype(body_type, return_type)) {
+                semant_error(c) << "Method " << method->get_name() 
+                               << " returns " << body_type 
+                               << " but should return " << return_type << endl;
+            }
         }
-        
-        return result_type;
     }
-    else if (auto let = dynamic_cast<let_class*>(expr)) {
-        // Let表达式
-        Symbol var_type = let->get_type_decl();
-        if (var_type == SELF_TYPE) {
-            semant_error(filename, expr) << "Let variable cannot have type SELF_TYPE" << endl;
-            var_type = Object;
+}
+
+// 表达式检查用显式栈代替递归：每个尚未完成的表达式占一帧，子表达式完成后
+// 其类型经 result 交回父帧，父帧从 step 记录的位置继续。无论嵌套多深，
+// 原生栈的使用都是常数；栈按线程复用，正常程序上不增加分配
+struct CheckFrame {
+    Expression expr;
+    ExprKind kind;
+    int step;                   // 已完成的步骤
+    int index;                  // 列表（块、实参、case 分支）中下一个元素的位置
+    int mark;                   // case：本帧的分支类型在 case_types 中的起点
+    Symbol first;               // 各种类暂存的类型：调用的接收者类型、if 的 then 分支类型、
+    Symbol second;              // let 的变量类型、二元运算的左操作数类型；调用的查找类型
+    const MethodSlot *target;   // 调用解析到的方法
+};
+
+// 调用的各步骤（接在接收者之后）
+enum {
+    CALL_BEGIN = 2,         // 解析方法
+    CALL_ACTUALS,           // 依次检查实参并与形参比较
+    CALL_ACTUALS_ONLY,      // 方法未定义或参数个数不符：只检查实参
+    CALL_UNDEFINED_CLASS,   // 静态调用的类型未定义：只检查实参
+};
+
+static thread_local std::vector<CheckFrame> check_stack;
+static thread_local std::vector<Symbol> case_types;   // 各层 case 的分支类型，按帧嵌套顺序存放
+
+// 每个表达式只在这里入栈（叶子在父帧中直接求值并计数），--stats 的按种类计数据此统计
+static inline void push_check_frame(std::vector<CheckFrame> &stack, Expression expr, ExprKind kind) {
+    SEMANT_COUNT(expr_checks[kind]);
+    CheckFrame frame = { expr, kind, 0, 0, 0, NULL, NULL, NULL };
+    stack.push_back(frame);
+}
+
+// 变量查找
+Symbol ClassTable::check_var(Expression expr, ObjectEnv &object_env, const char *filename) {
+    var_class *var = static_cast<var_class*>(expr);
+    Symbol *type_ptr = object_env.lookup(var->get_name());
+    if (type_ptr == NULL) {
+        semant_error(filename, expr) << "Undefined variable " << var->get_name() << endl;
+        return Object;
+    }
+    return *type_ptr;
+}
+
+// New表达式
+Symbol ClassTable::check_new(Expression expr, const char *filename) {
+    Symbol type_name = static_cast<new__class*>(expr)->get_type_name();
+    if (type_name != SELF_TYPE && get_class(type_name) == NULL) {
+        semant_error(filename, expr) << "new: undefined type " << type_name << endl;
+    }
+    return type_name;
+}
+
+// 调用在接收者检查完之后的步骤：result 为上一个完成的实参的类型。
+// 依次返回要检查的实参，全部完成时返回 NULL 并给出调用的类型
+Expression ClassTable::advance_call(CheckFrame &frame, Symbol method_name, Expressions actuals,
+                                    Symbol result, Symbol &type, const char *filename) {
+    if (frame.step == CALL_BEGIN) {
+        frame.target = find_method_slot(frame.second, method_name);
+        bool arity_ok = frame.target != NULL &&
+                        actuals->len() == frame.target->method->get_formals()->len();
+        frame.step = arity_ok ? CALL_ACTUALS : CALL_ACTUALS_ONLY;
+    } else if (frame.step == CALL_ACTUALS && frame.index > 0) {
+        // 上一个实参已检查完，与对应的形参比较
+        Expression actual = actuals->nth(frame.index - 1);
+        Symbol formal_type = frame.target->method->get_formals()->nth(frame.index - 1)->get_type();
+        if (!is_subtype(result, formal_type)) {
+            semant_error(filename, actual) << "Actual type " << result 
+                                          << " does not match formal type " << formal_type << endl;
         }
+    }
+    if (actuals->more(frame.index)) return actuals->nth(frame.index++);
+    
+    // 出错时实参照常检查，保证每个子表达式都标注了类型
+    if (frame.step == CALL_UNDEFINED_CLASS) {
+        semant_error(filename, frame.expr) << "Static dispatch to undefined class " << frame.second << "." << endl;
+        type = Object;
+        return NULL;
+    }
+    if (frame.target == NULL) {
+        semant_error(filename, frame.expr) << "Dispatch to undefined method " << method_name << endl;
+        type = Object;
+        return NULL;
+    }
+    if (frame.step == CALL_ACTUALS_ONLY) {
+        semant_error(filename, frame.expr) << "Method " << method_name 
+                                           << " called with wrong number of arguments" << endl;
+    }
+    record_dispatch(frame.expr, *frame.target, frame.second);
+    
+    // 方法返回 SELF_TYPE 时结果为接收者的类型
+    type = frame.target->method->get_return_type();
+    if (type == SELF_TYPE) type = frame.first;
+    return NULL;
+}
+
+// 表达式类型检查：每个表达式只检查一次，结果记录在节点上。
+// 错误的报告顺序与逐层递归检查完全相同
+Symbol ClassTable::type_check_expression(Expression root, Symbol current_class, 
+                                        ObjectEnv &object_env, 
+                                        const char *filename) {
+    std::vector<CheckFrame> &stack = check_stack;
+    size_t base = stack.size();
+    push_check_frame(stack, root, expr_kind(root));
+    Symbol result = NULL;   // 最近完成的表达式的类型
+    
+    while (stack.size() > base) {
+        CheckFrame &frame = stack.back();
+        Expression expr = frame.expr;
+        Expression child = NULL;   // 先检查这个子表达式，完成后回到本帧
+        Symbol type = Object;      // child 为 NULL 时本帧完成，类型为 type
         
-        // 进入新的作用域
-        object_env->enterscope();
+        switch (frame.kind) {
+        case EXPR_INT_CONST:
+            type = Int;
+            break;
+            
+        case EXPR_BOOL_CONST:
+            type = Bool;
+            break;
+            
+        case EXPR_STRING_CONST:
+            type = Str;
+            break;
+            
+        case EXPR_NO_EXPR:
+            type = No_type;
+            break;
+            
+        case EXPR_VAR:
+            type = check_var(expr, object_env, filename);
+            break;
         
-        // 添加变量到环境
-        if (let->get_init() != nullptr) {
-            Symbol init_type = type_check_expression(let->get_init(), current_class, object_env, filename);
-            if (!is_subtype(init_type, var_type)) {
-                semant_error(filename, let->get_init()) << "Initialization type mismatch" << endl;
+        case EXPR_ASSIGN: {
+            // 赋值表达式：先检查右边
+            assign_class *assign = static_cast<assign_class*>(expr);
+            if (frame.step++ == 0) {
+                child = assign->get_expr();
+                break;
+            }
+            Symbol var_name = assign->get_name();
+            Symbol *var_type_ptr = object_env.lookup(var_name);
+            if (var_type_ptr == NULL) {
+                semant_error(filename, expr) << "Assignment to undefined variable " << var_name << endl;
+                break;
             }
+            if (!is_subtype(result, *var_type_ptr)) {
+                semant_error(filename, expr) << "Type " << result 
+                                           << " is not subtype of " << *var_type_ptr << endl;
+            }
+            type = result;
+            break;
         }
         
-        object_env->addid(let->get_identifier(), new Symbol(var_type));
+        case EXPR_DISPATCH: {
+            // 方法调用：接收者默认是 self
+            dispatch_class *dispatch = static_cast<dispatch_class*>(expr);
+            if (frame.step == 0) {
+                frame.step = 1;
+                if (dispatch->get_expr() != nullptr) {
+                    child = dispatch->get_expr();
+                    break;
+                }
+                result = SELF_TYPE;
+            }
+            if (frame.step == 1) {
+                // 处理SELF_TYPE：在当前类的方法表中查找
+                frame.first = result;
+                frame.second = result == SELF_TYPE ? current_class : result;
+                frame.step = CALL_BEGIN;
+            }
+            child = advance_call(frame, dispatch->get_name(), dispatch->get_actuals(), result, type, filename);
+            break;
+        }
         
-        // 检查in表达式
-        Symbol body_type = type_check_expression(let->get_body(), current_class, object_env, filename);
+        case EXPR_STATIC_DISPATCH: {
+            // 静态调用 e@T.m(...)：接收者须是 T 的子类型，在 T 的方法表中查找
+            static_dispatch_class *dispatch = static_cast<static_dispatch_class*>(expr);
+            if (frame.step == 0) {
+                frame.step = 1;
+                child = dispatch->get_expr();
+                break;
+            }
+            if (frame.step == 1) {
+                Symbol receiver_type = result;
+                Symbol static_type = dispatch->get_type_name();
+                note_type(static_type);
+                frame.first = receiver_type;
+                frame.step = CALL_BEGIN;
+                
+                if (static_type == SELF_TYPE) {
+                    semant_error(filename, expr) << "Static dispatch to SELF_TYPE." << endl;
+                    static_type = current_class;
+                } else if (class_id(static_type) < 0) {
+                    frame.step = CALL_UNDEFINED_CLASS;
+                } else {
+                    Symbol actual_type = receiver_type == SELF_TYPE ? current_class : receiver_type;
+                    if (!is_subtype(actual_type, static_type)) {
+                        semant_error(filename, expr) << "Expression type " << receiver_type
+                                                   << " does not conform to declared static dispatch type "
+                                                   << static_type << "." << endl;
+                    }
+                }
+                frame.second = static_type;
+            }
+            child = advance_call(frame, dispatch->get_name(), dispatch->get_actuals(), result, type, filename);
+            break;
+        }
         
-        // 退出作用域
-        object_env->exitscope();
+        case EXPR_COND: {
+            // 条件表达式
+            cond_class *cond = static_cast<cond_class*>(expr);
+            switch (frame.step++) {
+            case 0:
+                child = cond->get_pred();
+                break;
+            case 1:
+                if (result != Bool) {
+                    semant_error(filename, cond->get_pred()) << "Predicate of 'if' must have type Bool" << endl;
+                }
+                child = cond->get_then_exp();
+                break;
+            case 2:
+                frame.first = result;
+                child = cond->get_else_exp();
+                break;
+            default:
+                type = lub(frame.first, result);
+                break;
+            }
+            break;
+        }
         
-        return body_type;
-    }
-    else if (auto typcase = dynamic_cast<typcase_class*>(expr)) {
-        // Case表达式
-        type_check_expression(typcase->get_expr(), current_class, object_env, filename);
+        case EXPR_LOOP: {
+            // 循环表达式，类型为 Object
+            loop_class *loop = static_cast<loop_class*>(expr);
+            switch (frame.step++) {
+            case 0:
+                child = loop->get_pred();
+                break;
+            case 1:
+                if (result != Bool) {
+                    semant_error(filename, loop->get_pred()) << "Predicate of 'while' must have type Bool" << endl;
+                }
+                child = loop->get_body();
+                break;
+            default:
+                type = Object;
+                break;
+            }
+            break;
+        }
         
-        std::vector<Symbol> branch_types;
-        Cases cases = typcase->get_cases();
+        case EXPR_BLOCK: {
+            // 块表达式：类型为最后一个表达式的类型
+            Expressions body = static_cast<block_class*>(expr)->get_body();
+            if (body->more(frame.index)) {
+                child = body->nth(frame.index++);
+                break;
+            }
+            type = frame.index > 0 ? result : No_type;
+            break;
+        }
         
-        for (int i = cases->first(); cases->more(i); i = cases->next(i)) {
-            Branch branch = cases->nth(i);
-            Symbol branch_type = branch->get_type_decl();
-            
-            // 检查分支类型唯一性
-            for (Symbol prev_type : branch_types) {
-                if (prev_type == branch_type) {
-                    semant_error(filename, branch) << "Duplicate branch type " << branch_type << endl;
+        case EXPR_LET: {
+            // Let表达式
+            let_class *let = static_cast<let_class*>(expr);
+            if (frame.step == 0) {
+                Symbol var_type = let->get_type_decl();
+                note_type(var_type);
+                if (var_type == SELF_TYPE) {
+                    semant_error(filename, expr) << "Let variable cannot have type SELF_TYPE" << endl;
+                    var_type = Object;
+                }
+                frame.first = var_type;
+                frame.step = 1;
+                
+                // 进入新的作用域（无初始化时为 no_expr，类型为 No_type）
+                object_env.enterscope();
+                if (let->get_init() != nullptr) {
+                    child = let->get_init();
                     break;
                 }
+                result = NULL;
             }
-            branch_types.push_back(branch_type);
-            
-            // 检查分支表达式
-            object_env->enterscope();
-            object_env->addid(branch->get_name(), new Symbol(branch_type));
-            
-            Symbol case_type = type_check_expression(branch->get_expr(), current_class, object_env, filename);
-            branch_types.back() = case_type;  // 使用实际表达式类型
-            
-            object_env->exitscope();
+            if (frame.step == 1) {
+                if (result != NULL && !is_subtype(result, frame.first)) {
+                    semant_error(filename, let->get_init()) << "Initialization type mismatch" << endl;
+                }
+                frame.step = 2;
+                object_env.addid(let->get_identifier(), frame.first);
+                child = let->get_body();
+                break;
+            }
+            object_env.exitscope();
+            type = result;
+            break;
         }
         
-        // 返回所有分支类型的LUB
-        Symbol result_type = branch_types[0];
-        for (size_t i = 1; i < branch_types.size(); i++) {
-            result_type = lub(result_type, branch_types[i]);
-        }
-        return result_type;
-    }
-    else if (auto new_ = dynamic_cast<new__class*>(expr)) {
-        // New表达式
-        Symbol type_name = new_->get_type_name();
-        if (type_name != SELF_TYPE && get_class(type_name) == NULL) {
-            semant_error(filename, expr) << "new: undefined type " << type_name << endl;
-        }
-        return type_name;
-    }
-    else if (auto isvoid = dynamic_cast<isvoid_class*>(expr)) {
-        // IsVoid表达式
-        type_check_expression(isvoid->get_expr(), current_class, object_env, filename);
-        return Bool;
-    }
-    else if (auto plus = dynamic_cast<plus_class*>(expr) ||
-               auto minus = dynamic_cast<minus_class*>(expr) ||
-               auto times = dynamic_cast<times_class*>(expr) ||
-               auto divide = dynamic_cast<divide_class*>(expr)) {
-        // 算术运算
-        Symbol left_type = type_check_expression(plus->get_left(), current_class, object_env, filename);
-        Symbol right_type = type_check_expression(plus->get_right(), current_class, object_env, filename);
-        
-        if (left_type != Int || right_type != Int) {
-            semant_error(filename, expr) << "Arithmetic operation on non-integer operands" << endl;
+        case EXPR_TYPCASE: {
+            // Case表达式：各分支的类型依次压入 case_types，最后一次求 LUB
+            typcase_class *typcase = static_cast<typcase_class*>(expr);
+            Cases cases = typcase->get_cases();
+            if (frame.step == 0) {
+                frame.step = 1;
+                child = typcase->get_expr();
+                break;
+            }
+            if (frame.index == 0) {
+                frame.mark = case_types.size();
+            } else {
+                case_types.back() = result;  // 使用实际表达式类型
+                object_env.exitscope();
+            }
+            if (cases->more(frame.index)) {
+                Branch branch = cases->nth(frame.index++);
+                Symbol branch_type = branch->get_type_decl();
+                note_type(branch_type);
+                
+                // 检查分支类型唯一性
+                for (size_t i = frame.mark; i < case_types.size(); i++) {
+                    if (case_types[i] == branch_type) {
+                        semant_error(filename, branch) << "Duplicate branch type " << branch_type << endl;
+                        break;
+                    }
+                }
+                case_types.push_back(branch_type);
+                
+                object_env.enterscope();
+                object_env.addid(branch->get_name(), branch_type);
+                child = branch->get_expr();
+                break;
+            }
+            
+            // 返回所有分支类型的LUB（一次 n 路求值）
+            type = lub(case_types.data() + frame.mark, case_types.size() - frame.mark);
+            case_types.resize(frame.mark);
+            break;
         }
         
-        return Int;
-    }
-    else if (auto lt = dynamic_cast<lt_class*>(expr) ||
-               auto leq = dynamic_cast<leq_class*>(expr)) {
-        // 比较运算
-        Symbol left_type = type_check_expression(lt->get_left(), current_class, object_env, filename);
-        Symbol right_type = type_check_expression(lt->get_right(), current_class, object_env, filename);
+        case EXPR_NEW:
+            type = check_new(expr, filename);
+            break;
         
-        if (left_type != Int || right_type != Int) {
-            semant_error(filename, expr) << "Comparison operation on non-integer operands" << endl;
+        case EXPR_ISVOID:
+            if (frame.step++ == 0) {
+                child = static_cast<isvoid_class*>(expr)->get_expr();
+                break;
+            }
+            type = Bool;
+            break;
+        
+        case EXPR_PLUS:
+        case EXPR_MINUS:
+        case EXPR_TIMES:
+        case EXPR_DIVIDE:
+        case EXPR_LT:
+        case EXPR_LEQ:
+        case EXPR_EQ: {
+            // 算术、比较和相等运算：依次检查左右操作数
+            Expression left, right;
+            binary_operands(frame.kind, expr, left, right);
+            if (frame.step == 0) {
+                frame.step = 1;
+                child = left;
+                break;
+            }
+            if (frame.step == 1) {
+                frame.step = 2;
+                frame.first = result;
+                child = right;
+                break;
+            }
+            Symbol left_type = frame.first;
+            Symbol right_type = result;
+            if (frame.kind == EXPR_EQ) {
+                // 基本类型之间可以比较
+                if ((left_type == Int || left_type == Bool || left_type == Str) && 
+                    left_type != right_type) {
+                    semant_error(filename, expr) << "Equality comparison between different basic types" << endl;
+                }
+                type = Bool;
+            } else if (frame.kind == EXPR_LT || frame.kind == EXPR_LEQ) {
+                if (left_type != Int || right_type != Int) {
+                    semant_error(filename, expr) << "Comparison operation on non-integer operands" << endl;
+                }
+                type = Bool;
+            } else {
+                if (left_type != Int || right_type != Int) {
+                    semant_error(filename, expr) << "Arithmetic operation on non-integer operands" << endl;
+                }
+                type = Int;
+            }
+            break;
         }
         
-        return Bool;
-    }
-    else if (auto eq = dynamic_cast<eq_class*>(expr)) {
-        // 相等运算
-        Symbol left_type = type_check_expression(eq->get_left(), current_class, object_env, filename);
-        Symbol right_type = type_check_expression(eq->get_right(), current_class, object_env, filename);
+        case EXPR_COMP: {
+            // 逻辑非
+            comp_class *comp = static_cast<comp_class*>(expr);
+            if (frame.step++ == 0) {
+                child = comp->get_expr();
+                break;
+            }
+            if (result != Bool) {
+                semant_error(filename, comp->get_expr()) << "'not' operand must have type Bool" << endl;
+            }
+            type = Bool;
+            break;
+        }
         
-        // 基本类型之间可以比较
-        if ((left_type == Int || left_type == Bool || left_type == Str) && 
-            left_type != right_type) {
-            semant_error(filename, expr) << "Equality comparison between different basic types" << endl;
+        case EXPR_NEG: {
+            // 算术取负
+            neg_class *neg = static_cast<neg_class*>(expr);
+            if (frame.step++ == 0) {
+                child = neg->get_expr();
+                break;
+            }
+            if (result != Int) {
+                semant_error(filename, neg->get_expr()) << "'~' operand must have type Int" << endl;
+            }
+            type = Int;
+            break;
         }
         
-        return Bool;
-    }
-    else if (auto comp = dynamic_cast<comp_class*>(expr)) {
-        // 逻辑非
-        Symbol type = type_check_expression(comp->get_expr(), current_class, object_env, filename);
-        if (type != Bool) {
-            semant_error(filename, comp->get_expr()) << "'not' operand must have type Bool" << endl;
+        default:
+            break;
         }
-        return Bool;
-    }
-    else if (auto neg = dynamic_cast<neg_class*>(expr)) {
-        // 算术取负
-        Symbol type = type_check_expression(neg->get_expr(), current_class, object_env, filename);
-        if (type != Int) {
-            semant_error(filename, neg->get_expr()) << "'~' operand must have type Int" << endl;
+        
+        if (child != NULL) {
+            // 常量、变量和 new 没有子表达式，直接求出类型后回到本帧，不必压栈
+            ExprKind kind = expr_kind(child);
+            switch (kind) {
+            case EXPR_INT_CONST:    result = Int; break;
+            case EXPR_BOOL_CONST:   result = Bool; break;
+            case EXPR_STRING_CONST: result = Str; break;
+            case EXPR_NO_EXPR:      result = No_type; break;
+            case EXPR_VAR:          result = check_var(child, object_env, filename); break;
+            case EXPR_NEW:          result = check_new(child, filename); break;
+            default:
+                push_check_frame(stack, child, kind);   // frame 此后可能失效
+                continue;
+            }
+            SEMANT_COUNT(expr_checks[kind]);
+            child->set_type(result);
+            note_type(result);
+            continue;
         }
-        return Int;
+        expr->set_type(type);
+        note_type(type);
+        result = type;
+        stack.pop_back();
     }
-    
-    return Object;  // 默认返回Object
+    return result;
 }
 
 // 辅助方法实现
 bool ClassTable::is_subtype(Symbol child, Symbol parent) {
+    SEMANT_COUNT(is_subtype_calls);
     if (child == parent) return true;
     if (child == SELF_TYPE && parent == SELF_TYPE) return true;
     if (child == SELF_TYPE) return true;  // SELF_TYPE 可赋值给任何类型
     if (parent == SELF_TYPE) return false; // 任何类型不能赋值给SELF_TYPE
     if (child == No_type) return true;    // No_type 是所有类型的子类型
     
-    // 常规继承检查
-    if (child == Object) return false;
-    
-    Class_ child_class = get_class(child);
-    if (child_class == NULL) return false;
+    // 常规继承检查：parent 的 DFS 区间包含 child 的区间
+    int c = class_id(child);
+    int p = class_id(parent);
+    if (c < 0 || p < 0 || pre_order[c] < 0 || pre_order[p] < 0) return false;
     
-    Symbol parent_of_child = child_class->get_parent();
-    return parent_of_child != No_class && is_subtype(parent_of_child, parent);
+    return pre_order[p] <= pre_order[c] && post_order[c] <= post_order[p];
 }
 
 Symbol ClassTable::lub(Symbol type1, Symbol type2) {
+    SEMANT_COUNT(lub_calls);
     if (type1 == type2) return type1;
     if (type1 == No_type) return type2;
     if (type2 == No_type) return type1;
     if (type1 == SELF_TYPE && type2 == SELF_TYPE) return SELF_TYPE;
     if (type1 == SELF_TYPE || type2 == SELF_TYPE) return Object;
     
-    // 如果一个是另一个的子类型，返回父类型
-    if (is_subtype(type1, type2)) return type2;
-    if (is_subtype(type2, type1)) return type1;
+    int a = class_id(type1);
+    int b = class_id(type2);
+    if (a < 0 || b < 0 || pre_order[a] < 0 || pre_order[b] < 0) return Object;
     
-    // 寻找共同祖先
-    Class_ c1 = get_class(type1);
-    Class_ c2 = get_class(type2);
+    return registry.get(cached_lca(a, b))->get_name();
+}
+
+// n 路 LUB：规则与两两折叠 lub 相同。一组结点的最近公共祖先等于其中
+// DFS 先序编号最小和最大的两个结点的最近公共祖先，因此只需一次 LCA 查询。
+// 与折叠一样，除 No_type 外只有一种类型时直接返回它（即使它没有定义）
+Symbol ClassTable::lub(const Symbol *types, size_t n) {
+    SEMANT_COUNT(lub_calls);
+    int first = -1;         // 先序编号最小的类
+    int last = -1;          // 先序编号最大的类
+    Symbol single = NULL;   // 第一个不是 No_type 的类型
+    bool mixed = false;     // 是否还有别的类型
+    bool self_type = false;
+    bool unknown = false;
+    for (size_t i = 0; i < n; i++) {
+        Symbol type = types[i];
+        if (type == No_type) continue;
+        if (single == NULL) single = type;
+        else if (type != single) mixed = true;
+        if (type == SELF_TYPE) {
+            self_type = true;
+            continue;
+        }
+        int id = class_id(type);
+        if (id < 0 || pre_order[id] < 0) {
+            unknown = true;
+            continue;
+        }
+        if (first < 0 || pre_order[id] < pre_order[first]) first = id;
+        if (last < 0 || pre_order[id] > pre_order[last]) last = id;
+    }
+    if (single == NULL) return No_type;
+    if (!mixed) return single;
+    if (unknown || self_type) return Object;
+    return registry.get(cached_lca(first, last))->get_name();
+}
+
+// LCA 查询前面的直接映射缓存，见 lub_cache
+int ClassTable::cached_lca(int a, int b) {
+    if (a == b) return a;
+    if (semant_lub_cache_size <= 0) return lca(a, b);
+    if (a > b) std::swap(a, b);
     
-    if (c1 == NULL || c2 == NULL) return Object;
+    if (lub_cache.size() != (size_t) semant_lub_cache_size) {
+        lub_cache.assign(semant_lub_cache_size, LubCacheEntry());
+    }
+    size_t h = ((size_t) a * 0x9E3779B1u) ^ ((size_t) b * 0x85EBCA77u);
+    LubCacheEntry &entry = lub_cache[(h ^ (h >> 15)) & (semant_lub_cache_size - 1)];
+    if (entry.generation == lub_generation && entry.a == a && entry.b == b) {
+        SEMANT_COUNT(lub_cache_hits);
+        return entry.result;
+    }
+    SEMANT_COUNT(lub_cache_misses);
+    entry.generation = lub_generation;
+    entry.a = a;
+    entry.b = b;
+    entry.result = lca(a, b);
+    return entry.result;
+}
+
+// 倍增法求最近公共祖先
+int ClassTable::lca(int a, int b) {
+    if (depths[a] < depths[b]) std::swap(a, b);
+    
+    int n = registry.size();
+    int diff = depths[a] - depths[b];
+    for (int k = 0; k < ancestor_levels; k++) {
+        if ((diff >> k) & 1) {
+            SEMANT_COUNT(lub_steps);
+            a = ancestors[k * n + a];
+        }
+    }
+    if (a == b) return a;
     
-    // 收集所有祖先
-    std::vector<Symbol> ancestors1, ancestors2;
-    Symbol current = type1;
-    while (current != No_class) {
-        ancestors1.push_back(current);
-        Class_ cls = get_class(current);
-        if (cls == NULL) break;
-        current = cls->get_parent();
+    for (int k = ancestor_levels - 1; k >= 0; k--) {
+        SEMANT_COUNT(lub_steps);
+        const int *level = &ancestors[k * n];
+        if (level[a] != level[b]) {
+            a = level[a];
+            b = level[b];
+        }
     }
+    return ancestors[a];
+}
+
+int ClassTable::class_id(Symbol name) {
+    return registry.find(name);
+}
+
+Class_ ClassTable::get_class(Symbol name) {
+    int id = registry.find(name);
+    return id >= 0 ? registry.get(id) : NULL;
+}
+
+// 检查重写方法的签名与被重写方法一致
+void ClassTable::check_method_override(Class_ cls, method_class *method, method_class *parent_method) {
+    Symbol method_name = method->get_name();
+    Formals parent_formals = parent_method->get_formals();
+    Formals child_formals = method->get_formals();
     
-    current = type2;
-    while (current != No_class) {
-        ancestors2.push_back(current);
-        Class_ cls = get_class(current);
-        if (cls == NULL) break;
-        current = cls->get_parent();
+    // 检查参数数量
+    if (parent_formals->len() != child_formals->len()) {
+        semant_error(cls) << "Method " << method_name 
+                        << " overrides method with different number of parameters" << endl;
+        return;
     }
     
-    // 从最具体到最通用寻找共同祖先
-    for (int i = 0; i < ancestors1.size(); i++) {
-        for (int j = 0; j < ancestors2.size(); j++) {
-            if (ancestors1[i] == ancestors2[j]) {
-                return ancestors1[i];
-            }
+    // 检查参数类型
+    for (int k = parent_formals->first(), l = child_formals->first();
+         parent_formals->more(k) && child_formals->more(l);
+         k = parent_formals->next(k), l = child_formals->next(l)) {
+        if (parent_formals->nth(k)->get_type() != child_formals->nth(l)->get_type()) {
+            semant_error(cls) << "Method " << method_name 
+                            << " overrides method with incompatible parameter types" << endl;
+            return;
         }
     }
     
-    return Object;  // 最坏情况下返回Object
+    // 检查返回类型
+    if (parent_method->get_return_type() != method->get_return_type()) {
+        semant_error(cls) << "Method " << method_name 
+                        << " overrides method with different return type" << endl;
+    }
 }
 
-Class_ ClassTable::get_class(Symbol name) {
-    if (name == Object) return &Object_class;
-    if (name == IO) return &IO_class;
-    if (name == Int) return &Int_class;
-    if (name == Bool) return &Bool_class;
-    if (name == Str) return &Str_class;
+// 构建方法表和属性表：自顶向下一遍完成，每个类在父类表的副本上
+// 加入自己的特性，同时检查每个重写的方法和重定义的属性
+void ClassTable::build_method_tables() {
+    // 按 DFS 先序处理，父类总在子类之前；继承环上或父类未定义的类排在最后，
+    // 它们的表只包含自己定义的特性
+    std::vector<int> order;
+    // 基本类的表与程序无关，只在第一次时建立
+    int n = registry.size();
+    int first = basic_tables_built ? BASIC_CLASS_COUNT : 0;
+    method_tables.resize(first);
+    method_tables.resize(n);
+    vtables.resize(first);
+    vtables.resize(n);
+    attr_tables.resize(first);
+    attr_tables.resize(n);
+    for (int v = first; v < n; v++) order.push_back(v);
+    std::stable_sort(order.begin(), order.end(), [this](int a, int b) {
+        unsigned int ka = (unsigned int) pre_order[a];
+        unsigned int kb = (unsigned int) pre_order[b];
+        return ka < kb;
+    });
     
-    Class_ *class_ptr = class_table->lookup(name);
-    return class_ptr ? *class_ptr : NULL;
+    for (int v : order) {
+        if (v < BASIC_CLASS_COUNT) install_builtin_tables(v);
+        else build_class_tables(v);
+    }
+    basic_tables_built = true;
 }
 
-void ClassTable::check_method_override(Class_ cls) {
-    Symbol class_name = cls->get_name();
-    Features features = cls->get_features();
+// 基本类的表按 prelude.h 中写定的虚表位置直接填入，基本类之间没有重写
+void ClassTable::install_builtin_tables(int v) {
+    const BuiltinClass &spec = builtin_classes[v];
+    const BuiltinPrelude &prelude = builtin_prelude();
+    MethodTable &table = method_tables[v];
+    AttrTable &attrs = attr_tables[v];
+    std::vector<method_class*> &vtable = vtables[v];
+    if (spec.parent >= 0) {
+        table = method_tables[spec.parent];
+        attrs = attr_tables[spec.parent];
+        vtable = vtables[spec.parent];
+    }
     
+    vtable.resize(builtin_vtable_size(v));
+    for (int m = 0; m < spec.method_count; m++) {
+        MethodSlot slot = { prelude.methods[v][m], spec.methods[m].slot };
+        table[slot.method->get_name()] = slot;
+        vtable[slot.slot] = slot.method;
+    }
+    for (int a = 0; a < spec.attr_count; a++) {
+        attr_class *attr = prelude.attrs[v][a];
+        attrs.insert(std::make_pair(attr->get_name(), attr));
+    }
+}
+
+void ClassTable::build_class_tables(int v) {
+    Class_ cls = registry.get(v);
+    MethodTable &table = method_tables[v];
+    AttrTable &attrs = attr_tables[v];
+    std::vector<method_class*> &vtable = vtables[v];
+    
+    const MethodTable *parent_methods = NULL;
+    const AttrTable *parent_attrs = NULL;
+    int p = parent_ids[v];
+    if (p >= 0 && pre_order[v] >= 0) {
+        parent_methods = &method_tables[p];
+        parent_attrs = &attr_tables[p];
+        table = *parent_methods;
+        attrs = *parent_attrs;
+        vtable = vtables[p];
+    }
+    
+    Features features = cls->get_features();
     for (int i = features->first(); features->more(i); i = features->next(i)) {
         Feature f = features->nth(i);
-        if (auto method = dynamic_cast<method_class*>(f)) {
-            Symbol method_name = method->get_name();
+        
+        if (auto method = as_method(f)) {
+            Symbol name = method->get_name();
+            const MethodSlot *inherited = NULL;
+            if (parent_methods != NULL) {
+                auto it = parent_methods->find(name);
+                if (it != parent_methods->end()) inherited = &it->second;
+            }
             
-            // 在父类中查找同名方法
-            Class_ current_class = cls;
-            Symbol parent = current_class->get_parent();
+            // 同一类中重复定义的方法以第一次定义为准
+            auto entry = table.find(name);
+            if (entry != table.end() && (inherited == NULL || entry->second.method != inherited->method)) continue;
             
-            while (parent != No_class) {
-                Class_ *parent_class_ptr = class_table->lookup(parent);
-                if (parent_class_ptr == NULL) break;
-                
-                Class_ parent_class = *parent_class_ptr;
-                Features parent_features = parent_class->get_features();
-                
-                for (int j = parent_features->first(); parent_features->more(j); j = parent_features->next(j)) {
-                    Feature pf = parent_features->nth(j);
-                    if (auto parent_method = dynamic_cast<method_class*>(pf)) {
-                        if (parent_method->get_name() == method_name) {
-                            // 检查方法签名兼容性
-                            Formals parent_formals = parent_method->get_formals();
-                            Formals child_formals = method->get_formals();
-                            
-                            // 检查参数数量
-                            if (parent_formals->len() != child_formals->len()) {
-                                semant_error(cls) << "Method " << method_name 
-                                                << " overrides method with different number of parameters" << endl;
-                                return;
-                            }
-                            
-                            // 检查参数类型
-                            bool params_compatible = true;
-                            for (int k = parent_formals->first(), l = child_formals->first();
-                                 parent_formals->more(k) && child_formals->more(l);
-                                 k = parent_formals->next(k), l = child_formals->next(l)) {
-                                Formal parent_f = parent_formals->nth(k);
-                                Formal child_f = child_formals->nth(l);
-                                
-                                if (parent_f->get_type() != child_f->get_type()) {
-                                    params_compatible = false;
-                                    break;
-                                }
-                            }
-                            
-                            // 检查返回类型
-                            Symbol parent_return = parent_method->get_return_type();
-                            Symbol child_return = method->get_return_type();
-                            
-                            if (!params_compatible) {
-                                semant_error(cls) << "Method " << method_name 
-                                                << " overrides method with incompatible parameter types" << endl;
-                                return;
-                            }
-                            
-                            if (parent_return != child_return) {
-                                semant_error(cls) << "Method " << method_name 
-                                                << " overrides method with different return type" << endl;
-                                return;
+            // 重写的方法占用父类中的位置，新方法追加到虚表末尾
+            MethodSlot slot;
+            slot.method = method;
+            if (inherited != NULL) {
+                check_method_override(cls, method, inherited->method);
+                slot.slot = inherited->slot;
+                vtable[slot.slot] = method;
+            } else {
+                slot.slot = vtable.size();
+                vtable.push_back(method);
+            }
+            table[name] = slot;
+        } else if (auto attr = as_attr(f)) {
+            Symbol name = attr->get_name();
+            if (parent_attrs != NULL && parent_attrs->count(name) > 0) {
+                semant_error(cls) << "Attribute " << name 
+                                  << " is an attribute of an inherited class." << endl;
+            } else {
+                attrs.insert(std::make_pair(name, attr));
+            }
+        }
+    }
+}
+
+method_class* ClassTable::find_method(Symbol class_name, Symbol method_name) {
+    const MethodSlot *slot = find_method_slot(class_name, method_name);
+    return slot != NULL ? slot->method : NULL;
+}
+
+const MethodSlot *ClassTable::find_method_slot(Symbol class_name, Symbol method_name) {
+    SEMANT_COUNT(find_method_calls);
+    int id = registry.find(class_name);
+    if (id < 0) return NULL;
+    
+    const MethodTable &table = method_tables[id];
+    auto method = table.find(method_name);
+    return method != table.end() ? &method->second : NULL;
+}
+
+const std::vector<method_class*> *ClassTable::vtable(Symbol class_name) {
+    int id = registry.find(class_name);
+    return id >= 0 ? &vtables[id] : NULL;
+}
+
+// 类型检查时只追加到记录中（并行检查时先记在当前类的结果里），
+// 第一次查询时才建立哈希索引
+void ClassTable::record_dispatch(Expression expr, const MethodSlot &target, Symbol receiver) {
+    DispatchSite site = { expr, target, receiver, DISPATCH_MEGAMORPHIC, NULL, NULL };
+    if (current_diagnostics != NULL) {
+        current_diagnostics->dispatches.push_back(site);
+    } else {
+        dispatch_log.push_back(site);
+    }
+}
+
+const DispatchSite *ClassTable::dispatch_site(Expression expr) {
+    if (dispatch_targets.size() != dispatch_log.size()) {
+        dispatch_targets.clear();
+        dispatch_targets.reserve(dispatch_log.size());
+        for (size_t i = 0; i < dispatch_log.size(); i++) {
+            dispatch_targets.insert(std::make_pair(dispatch_log[i].expr, i));
+        }
+    }
+    auto it = dispatch_targets.find(expr);
+    return it != dispatch_targets.end() ? &dispatch_log[it->second] : NULL;
+}
+
+const MethodSlot *ClassTable::dispatch_target(Expression expr) {
+    const DispatchSite *site = dispatch_site(expr);
+    return site != NULL ? &site->target : NULL;
+}
+
+// 类层次分析：动态调用的接收者可能是其静态类型子树中的任何类，
+// 统计子树中虚表该位置上不同实现的个数。子类重写总是产生新的实现，
+// 所以实现个数等于 1 加上子树中重写该位置的类数；找到两个重写即可停止。
+// 结果按（接收者类，虚表位置）记忆，同一接收者上的调用只遍历一次子树
+void ClassTable::devirtualize() {
+    for (int k = 0; k < DISPATCH_SHAPE_COUNT; k++) dispatch_shapes[k] = 0;
+    
+    struct Analysis {
+        DispatchShape shape;
+        int split_class;
+        method_class *split_method;
+    };
+    std::unordered_map<long long, Analysis> analyses;
+    std::vector<int> stack;
+    
+    for (DispatchSite &site : dispatch_log) {
+        site.shape = DISPATCH_MEGAMORPHIC;
+        site.split_class = NULL;
+        site.split_method = NULL;
+        int r = class_id(site.receiver);
+        if (typeid(*site.expr) == typeid(static_dispatch_class)) {
+            site.shape = DISPATCH_STATIC;
+        } else if (r >= 0 && pre_order[r] >= 0) {
+            long long key = (long long) r * vtables.size() + site.target.slot;
+            auto found = analyses.find(key);
+            if (found == analyses.end()) {
+                Analysis a = { DISPATCH_MONOMORPHIC, -1, NULL };
+                int slot = site.target.slot;
+                stack.clear();
+                stack.push_back(r);
+                while (!stack.empty() && a.shape != DISPATCH_MEGAMORPHIC) {
+                    int v = stack.back();
+                    stack.pop_back();
+                    for (int i = child_begin[v]; i < child_begin[v + 1]; i++) {
+                        int c = child_list[i];
+                        if (vtables[c][slot] != vtables[v][slot]) {
+                            if (a.shape == DISPATCH_BIMORPHIC) {
+                                a.shape = DISPATCH_MEGAMORPHIC;
+                                break;
                             }
-                            
-                            return;  // 找到并重写了方法，退出
+                            a.shape = DISPATCH_BIMORPHIC;
+                            a.split_class = c;
+                            a.split_method = vtables[c][slot];
                         }
+                        stack.push_back(c);
                     }
                 }
-                
-                parent = parent_class->get_parent();
+                found = analyses.insert(std::make_pair(key, a)).first;
+            }
+            const Analysis &a = found->second;
+            site.shape = a.shape;
+            if (a.shape == DISPATCH_BIMORPHIC) {
+                site.split_class = registry.get(a.split_class)->get_name();
+                site.split_method = a.split_method;
             }
         }
+        dispatch_shapes[site.shape]++;
     }
 }
 
-method_class* ClassTable::find_method(Symbol class_name, Symbol method_name) {
-    Class_ cls = get_class(class_name);
-    if (cls == NULL) return NULL;
+// 增量检查：指纹与签名使用 64 位 FNV-1a 哈希
+static unsigned long long fnv1a(const char *text, size_t length,
+                                unsigned long long hash = 14695981039346656037ULL) {
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char) text[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static unsigned long long fnv1a(const std::string &text) {
+    return fnv1a(text.data(), text.size());
+}
+
+// 类 AST 的指纹：dump_with_types 的输出（含文件名和行号）去掉类型标注行
+// （": 类型"），同一个类检查前后的指纹相同，常驻进程保留的已检查的类也适用
+unsigned long long ClassTable::class_fingerprint(Class_ c) {
+    std::ostringstream dump;
+    c->dump_with_types(dump, 0);
+    const std::string text = dump.str();
+    unsigned long long hash = fnv1a(NULL, 0);
+    for (size_t start = 0; start < text.size(); ) {
+        size_t end = text.find('\n', start);
+        end = end == std::string::npos ? text.size() : end + 1;
+        size_t first = text.find_first_not_of(' ', start);
+        if (first >= end || text[first] != ':') hash = fnv1a(text.data() + start, end - start, hash);
+        start = end;
+    }
+    return hash;
+}
+
+// 类型的接口签名：祖先链、全部可见方法的签名和全部属性。
+// 引用该类型的类只有在签名变化时才需要重新检查
+unsigned long long ClassTable::interface_signature(Symbol type) {
+    auto cached = interface_signatures.find(type);
+    if (cached != interface_signatures.end()) return cached->second;
     
-    // 在当前类中查找
-    Features features = cls->get_features();
-    for (int i = features->first(); features->more(i); i = features->next(i)) {
-        Feature f = features->nth(i);
-        if (auto method = dynamic_cast<method_class*>(f)) {
-            if (method->get_name() == method_name) {
-                return method;
+    std::string text;
+    int id = class_id(type);
+    if (id < 0) {
+        text = std::string("?") + type->get_string();
+    } else {
+        // 祖先链（继承环上的类最多走 n 步）
+        std::vector<int> chain;
+        for (int v = id; v >= 0 && chain.size() <= (size_t) registry.size(); v = parent_ids[v]) {
+            chain.push_back(v);
+            text += registry.get(v)->get_name()->get_string();
+            text += '<';
+        }
+        
+        // 方法签名，按名字排序保证结果确定
+        {
+            std::vector<std::string> methods;
+            for (auto &entry : method_tables[id]) {
+                method_class *method = entry.second.method;
+                std::string sig = method->get_name()->get_string();
+                sig += '(';
+                Formals formals = method->get_formals();
+                for (int k = formals->first(); formals->more(k); k = formals->next(k)) {
+                    sig += formals->nth(k)->get_type()->get_string();
+                    sig += ',';
+                }
+                sig += ')';
+                sig += method->get_return_type()->get_string();
+                methods.push_back(sig);
+            }
+            std::sort(methods.begin(), methods.end());
+            for (size_t i = 0; i < methods.size(); i++) {
+                text += methods[i];
+                text += ';';
+            }
+        }
+        
+        // 属性（含继承的属性）
+        for (size_t i = 0; i < chain.size(); i++) {
+            Features features = registry.get(chain[i])->get_features();
+            for (int j = features->first(); features->more(j); j = features->next(j)) {
+                if (auto attr = as_attr(features->nth(j))) {
+                    text += attr->get_name()->get_string();
+                    text += ':';
+                    text += attr->get_type()->get_string();
+                    text += ';';
+                }
             }
         }
     }
     
-    // 在父类中递归查找
-    Symbol parent = cls->get_parent();
-    if (parent != No_class) {
-        return find_method(parent, method_name);
+    unsigned long long signature = fnv1a(text);
+    interface_signatures[type] = signature;
+    return signature;
+}
+
+// 缓存记录是否仍然有效：AST 未变且所有依赖类型的签名未变
+bool ClassTable::cache_entry_valid(const ClassCacheEntry &entry, unsigned long long fingerprint) {
+    if (entry.fingerprint != fingerprint) return false;
+    for (size_t i = 0; i < entry.deps.size(); i++) {
+        Symbol dep = idtable.add_string((char *) entry.deps[i].first.c_str());
+        if (interface_signature(dep) != entry.deps[i].second) return false;
     }
+    return true;
+}
+
+// 缓存文件格式（文本）：
+//   class <类名> <指纹> <错误数>
+//   dep <类型名> <签名>        （零或多行）
+//   err <一行错误输出>         （零或多行）
+//   end
+void load_class_cache(const char *path, std::unordered_map<std::string, ClassCacheEntry> &cache) {
+    std::ifstream in(path);
+    std::string line;
+    if (!std::getline(in, line) || line != "semant-cache 2") return;
     
-    return NULL;
+    ClassCacheEntry entry;
+    std::string name;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string tag;
+        fields >> tag;
+        if (tag == "class") {
+            entry = ClassCacheEntry();
+            fields >> name >> entry.fingerprint >> entry.error_count;
+        } else if (tag == "dep") {
+            std::string dep;
+            unsigned long long signature;
+            fields >> dep >> signature;
+            entry.deps.push_back(std::make_pair(dep, signature));
+        } else if (tag == "err") {
+            entry.errors += line.substr(4);
+            entry.errors += '\n';
+        } else if (tag == "end") {
+            cache[name] = entry;
+        }
+    }
+}
+
+void save_class_cache(const char *path, const std::unordered_map<std::string, ClassCacheEntry> &cache) {
+    std::ofstream out(path);
+    out << "semant-cache 2\n";
+    for (auto &item : cache) {
+        const ClassCacheEntry &entry = item.second;
+        out << "class " << item.first << " " << entry.fingerprint << " " << entry.error_count << "\n";
+        for (size_t i = 0; i < entry.deps.size(); i++) {
+            out << "dep " << entry.deps[i].first << " " << entry.deps[i].second << "\n";
+        }
+        std::istringstream errors(entry.errors);
+        std::string line;
+        while (std::getline(errors, line)) {
+            out << "err " << line << "\n";
+        }
+        out << "end\n";
+    }
+}
+
+// 错误报告方法：返回的流在换行时把消息记入当前的错误缓冲区
+ostream& ClassTable::semant_error(Class_ c) {
+    return begin_diagnostic(DIAG_CLASS, c->get_filename()->get_string(), c->get_line_number(), c->get_name());
+}
+
+ostream& ClassTable::semant_error(Class_ c, const char *msg) {
+    return semant_error(c) << msg;
+}
+
+ostream& ClassTable::semant_error(const char *filename, tree_node *t) {
+    return begin_diagnostic(DIAG_LOCATION, filename, t->get_line_number(), checking_class);
+}
+
+ostream& ClassTable::semant_error() {
+    return begin_diagnostic(DIAG_PLAIN, NULL, 0, checking_class);
+}
+
+ostream& ClassTable::begin_diagnostic(DiagnosticForm form, const char *filename, int line, Symbol class_name) {
+    const char *kind = diagnostic_kinds[current_phase];
+    if (current_diagnostics != NULL) {
+        return diagnostic_stream.begin(&current_diagnostics->diagnostics, &current_diagnostics->count,
+                                       form, filename, line, class_name, kind);
+    }
+    return diagnostic_stream.begin(&program_diagnostics, &::semant_errors,
+                                   form, filename, line, class_name, kind);
+}
+
+void flush_semant_diagnostics(std::ostream &out) {
+    diagnostic_stream.commit();
+    std::string text;
+    if (semant_json_diagnostics) {
+        program_diagnostics.render_json(text, semant_errors, diagnostic_notes);
+    } else {
+        program_diagnostics.render_text(text);
+        for (const DiagnosticNote &note : diagnostic_notes) {
+            text += note.message;
+            text += '\n';
+        }
+        if (semant_errors > 0) {
+            text += std::to_string(semant_errors) + " semantic errors.\n";
+        }
+    }
+    out.write(text.data(), text.size());
+    out.flush();
+    program_diagnostics.clear();
+    diagnostic_notes.clear();
+}
+
+// 统计信息
+void flush_semant_stats() {
+#ifdef SEMANT_STATS
+    std::lock_guard<std::mutex> guard(global_stats_lock);
+    long long *from = reinterpret_cast<long long*>(&semant_thread_stats);
+    long long *to = reinterpret_cast<long long*>(&global_stats);
+    for (size_t i = 0; i < sizeof(SemantStats) / sizeof(long long); i++) {
+        to[i] += from[i];
+        from[i] = 0;
+    }
+#endif
 }
 
-// 错误报告方法
-void ClassTable::semant_error(Class_ c) {
-    semant_error() << "In class " << c->get_name() << ": ";
+const SemantStats &semant_stats() {
+    return global_stats;
 }
 
-void ClassTable::semant_error(Class_ c, const char *msg) {
-    semant_error(c) << msg;
+#ifdef SEMANT_STATS
+static double average(long long total, long long count) {
+    return count > 0 ? (double) total / count : 0.0;
 }
+#endif
 
-void ClassTable::semant_error(const char *filename, tree_node *t, const char *msg) {
-    semant_error() << filename << ":" << t->get_line_number() << ": " << msg;
+void print_semant_stats(ClassTable *table, std::ostream &out) {
+    out << "semant statistics:" << endl;
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        out << "  phase " << semant_phase_names[p] << ": "
+            << table->phase_seconds[p] * 1000 << " ms, RSS "
+            << (table->phase_rss_delta_kb[p] >= 0 ? "+" : "") << table->phase_rss_delta_kb[p] << " KB" << endl;
+    }
+    int dynamic = 0;
+    out << "  dispatch sites:";
+    for (int k = 0; k < DISPATCH_SHAPE_COUNT; k++) {
+        out << (k > 0 ? ", " : " ") << dispatch_shape_names[k] << " " << table->dispatch_shapes[k];
+        if (k != DISPATCH_STATIC) dynamic += table->dispatch_shapes[k];
+    }
+    out << endl;
+    out << "  devirtualized: " << table->dispatch_shapes[DISPATCH_MONOMORPHIC] << " direct, "
+        << table->dispatch_shapes[DISPATCH_BIMORPHIC] << " guarded, of "
+        << dynamic << " dynamic dispatch sites" << endl;
+#ifdef SEMANT_STATS
+    const SemantStats &stats = semant_stats();
+    long long checks = 0;
+    for (int k = 0; k < EXPR_KIND_COUNT; k++) {
+        checks += stats.expr_checks[k];
+        if (stats.expr_checks[k] > 0) {
+            out << "  type_check_expression[" << expr_kind_names[k] << "]: " 
+                << stats.expr_checks[k] << endl;
+        }
+    }
+    out << "  type_check_expression total: " << checks << endl;
+    out << "  find_method calls: " << stats.find_method_calls << endl;
+    out << "  is_subtype calls: " << stats.is_subtype_calls << endl;
+    out << "  lub calls: " << stats.lub_calls << ", average steps "
+        << average(stats.lub_steps, stats.lub_calls) << endl;
+    out << "  lub cache (" << semant_lub_cache_size << " entries): " << stats.lub_cache_hits
+        << " hits, " << stats.lub_cache_misses << " misses" << endl;
+    out << "  scopes pushed/popped: " << stats.scope_pushes << "/" << stats.scope_pops << endl;
+    out << "  variable lookups: " << stats.env_lookups << ", average slots probed "
+        << average(stats.env_lookup_steps, stats.env_lookups) << endl;
+    out << "  arena allocations: " << stats.arena_allocations << " (" << stats.arena_bytes
+        << " bytes), blocks reserved " << stats.arena_block_bytes << " bytes" << endl;
+#else
+    out << "  (counters disabled; rebuild with -DSEMANT_STATS)" << endl;
+#endif
 }
 
-std::ostream& semant_error() {
-    semant_errors++;
-    cool::cerr << "ERROR: ";
-    return cool::cerr;
+void write_semant_stats_json(ClassTable *table, std::ostream &out) {
+    out << "{\n  \"phases\": {";
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        out << (p > 0 ? "," : "") << "\n    \"" << semant_phase_names[p] << "\": { \"ms\": "
+            << table->phase_seconds[p] * 1000 << ", \"rss_delta_kb\": " << table->phase_rss_delta_kb[p] << " }";
+    }
+    out << "\n  },\n  \"dispatch_sites\": {";
+    for (int k = 0; k < DISPATCH_SHAPE_COUNT; k++) {
+        out << (k > 0 ? ", " : " ") << "\"" << dispatch_shape_names[k] << "\": " << table->dispatch_shapes[k];
+    }
+    out << " }";
+#ifdef SEMANT_STATS
+    const SemantStats &stats = semant_stats();
+    out << ",\n  \"type_check_expression\": {";
+    bool first = true;
+    for (int k = 0; k < EXPR_KIND_COUNT; k++) {
+        if (stats.expr_checks[k] == 0) continue;
+        out << (first ? "" : ",") << "\n    \"" << expr_kind_names[k] << "\": " << stats.expr_checks[k];
+        first = false;
+    }
+    out << "\n  },\n"
+        << "  \"find_method_calls\": " << stats.find_method_calls << ",\n"
+        << "  \"is_subtype_calls\": " << stats.is_subtype_calls << ",\n"
+        << "  \"lub_calls\": " << stats.lub_calls << ",\n"
+        << "  \"lub_steps\": " << stats.lub_steps << ",\n"
+        << "  \"lub_cache_size\": " << semant_lub_cache_size << ",\n"
+        << "  \"lub_cache_hits\": " << stats.lub_cache_hits << ",\n"
+        << "  \"lub_cache_misses\": " << stats.lub_cache_misses << ",\n"
+        << "  \"scope_pushes\": " << stats.scope_pushes << ",\n"
+        << "  \"scope_pops\": " << stats.scope_pops << ",\n"
+        << "  \"env_lookups\": " << stats.env_lookups << ",\n"
+        << "  \"env_lookup_steps\": " << stats.env_lookup_steps << ",\n"
+        << "  \"arena_allocations\": " << stats.arena_allocations << ",\n"
+        << "  \"arena_bytes\": " << stats.arena_bytes << ",\n"
+        << "  \"arena_block_bytes\": " << stats.arena_block_bytes;
+#endif
+    out << "\n}\n";
+}
+
+// 处理语义分析器自己的选项，识别出的选项从 argv 中移除
+void handle_semant_flags(int &argc, char *argv[]) {
+    int out = 1;
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (strcmp(arg, "-j") == 0 && i + 1 < argc) {
+            semant_jobs = atoi(argv[++i]);
+        } else if (strncmp(arg, "-j", 2) == 0 && arg[2] >= '0' && arg[2] <= '9') {
+            semant_jobs = atoi(arg + 2);
+        } else if (strncmp(arg, "--jobs=", 7) == 0) {
+            semant_jobs = atoi(arg + 7);
+        } else if (strcmp(arg, "--lub-cache") == 0 && i + 1 < argc) {
+            semant_lub_cache_size = atoi(argv[++i]);
+        } else if (strncmp(arg, "--lub-cache=", 12) == 0) {
+            semant_lub_cache_size = atoi(arg + 12);
+        } else if (strcmp(arg, "--reachable") == 0) {
+            semant_reachable_only = true;
+        } else if (strcmp(arg, "--cache") == 0 && i + 1 < argc) {
+            semant_cache_file = argv[++i];
+        } else if (strncmp(arg, "--cache=", 8) == 0) {
+            semant_cache_file = arg + 8;
+        } else if (strcmp(arg, "--stats") == 0) {
+            semant_print_stats = true;
+        } else if (strcmp(arg, "--stats-json") == 0 && i + 1 < argc) {
+            semant_stats_json = argv[++i];
+        } else if (strncmp(arg, "--stats-json=", 13) == 0) {
+            semant_stats_json = arg + 13;
+        } else if (strcmp(arg, "--diagnostics=json") == 0) {
+            semant_json_diagnostics = true;
+        } else if (strcmp(arg, "--diagnostics=text") == 0) {
+            semant_json_diagnostics = false;
+        } else if (strcmp(arg, "--max-class-errors") == 0 && i + 1 < argc) {
+            semant_max_class_errors = atoi(argv[++i]);
+        } else if (strncmp(arg, "--max-class-errors=", 19) == 0) {
+            semant_max_class_errors = atoi(arg + 19);
+        } else {
+            argv[out++] = argv[i];
+        }
+    }
+    argc = out;
+    argv[argc] = NULL;
+    if (semant_jobs < 1) semant_jobs = 1;
+    // LUB 缓存大小取不小于给定值的 2 的幂
+    if (semant_lub_cache_size > 0) {
+        int size = 1;
+        while (size < semant_lub_cache_size) size *= 2;
+        semant_lub_cache_size = size;
+    }
 }
 
 // 主函数（由semant-phase.cc调用）
 void program_class::semant() {
+    // 上一个程序的 ClassTable 保留到现在
+    if (class_table != batch_table) delete class_table;
+    class_table = NULL;
+    
     global_classes = classes;
-    class_table = new ClassTable(classes);
+    program_diagnostics.set_max_per_class(semant_max_class_errors);
+    if (batch_table != NULL) {
+        class_table = batch_table;
+        class_table->check(classes);
+    } else {
+        class_table = new ClassTable(classes);
+    }
     
-    if (semant_errors > 0) {
-        cool::cerr << semant_errors << " semantic errors." << endl;
+    if (semant_print_stats || semant_stats_json != NULL) {
+        flush_semant_stats();
+        if (semant_print_stats) {
+            print_semant_stats(class_table, cool::cerr);
+        }
+        if (semant_stats_json != NULL) {
+            std::ofstream json(semant_stats_json);
+            write_semant_stats_json(class_table, json);
+        }
     }
     
-    delete class_table;
+    flush_semant_diagnostics(cool::cerr);
+}
+
+ClassTable *semant_class_table() {
+    return class_table;
+}
+
+void semant_begin_batch() {
+    if (batch_table == NULL) batch_table = new ClassTable();
+}
+
+void semant_end_batch() {
+    if (class_table == batch_table) class_table = NULL;
+    delete batch_table;
+    batch_table = NULL;
 }
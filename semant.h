@@ -5,6 +5,16 @@
 #include "symtab.h"
 #include "stringtab.h"
 #include "utilities.h"
+#include "arena.h"
+#include "semant-stats.h"
+#include "class-registry.h"
+#include "diagnostics.h"
+#include <unordered_map>
+#include <vector>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+#include <utility>
 
 class ClassTable;
 typedef ClassTable *ClassTableP;
@@ -13,20 +23,362 @@ typedef ClassTable *ClassTableP;
 extern Classes global_classes;
 extern int semant_errors;
 extern bool semant_debug;
+extern int semant_jobs;      // 并行检查类的线程数（-j N）
+extern const char *semant_cache_file;  // 增量检查的缓存文件（--cache FILE），NULL 表示关闭
+extern bool semant_print_stats;        // --stats：在标准错误输出统计信息
+extern const char *semant_stats_json;  // --stats-json FILE：统计信息的 JSON 输出文件
+extern bool semant_json_diagnostics;   // --diagnostics=json：以 JSON 格式输出错误
+extern int semant_max_class_errors;    // --max-class-errors N：每个类最多输出的错误数，0 表示不限
+extern int semant_lub_cache_size;      // --lub-cache N：每个线程 LUB 缓存的项数（2 的幂），0 表示关闭
+extern bool semant_reachable_only;     // --reachable：只检查从 Main.main 可达的类和方法
+
+// 处理语义分析器自己的命令行选项并从 argv 中移除，
+// semant-phase.cc 的 main 需在 handle_flags 之前调用：
+//   -j N, --jobs=N    用 N 个线程并行检查各个类
+//   --cache FILE      增量检查，只重新检查自身或所依赖类型发生变化的类
+//   --stats           输出各阶段耗时和计数器（计数器需以 -DSEMANT_STATS 编译）
+//   --stats-json FILE 以 JSON 格式把同样的统计信息写入 FILE
+//   --diagnostics=json|text  错误输出格式（默认 text）
+//   --max-class-errors N     每个类最多输出 N 条错误
+//   --lub-cache N     LUB 缓存的项数（默认 4096，0 关闭）
+//   --reachable       只检查从 Main.main 可达的类和方法，报告被裁剪的部分
+void handle_semant_flags(int &argc, char *argv[]);
+
+// 把收集到的错误（连同 "N semantic errors." 一行）一次写到 out 并清空，
+// program_class::semant() 结束时调用；直接使用 ClassTable 的程序需自行调用
+void flush_semant_diagnostics(std::ostream &out);
+
+// 最近一次 program_class::semant() 使用的 ClassTable，保留到下一次检查之前，
+// 代码生成可以从中取得方法表、虚表和调用目标
+ClassTable *semant_class_table();
+
+// 批处理模式：在 semant_begin_batch() 与 semant_end_batch() 之间，
+// program_class::semant() 复用同一个 ClassTable，基本类只安装一次
+void semant_begin_batch();
+void semant_end_batch();
+
+// 方法及其在所属类虚表中的位置
+struct MethodSlot {
+    method_class *method;
+    int slot;
+};
+
+// 类层次分析（CHA）得出的调用点形态
+enum DispatchShape {
+    DISPATCH_STATIC,        // e@T.m()，本来就是直接调用
+    DISPATCH_MONOMORPHIC,   // 接收者可能的所有类都使用同一实现，可直接调用 target
+    DISPATCH_BIMORPHIC,     // 两个实现：接收者是 split_class 的子类时调用 split_method，否则调用 target
+    DISPATCH_MEGAMORPHIC,   // 三个及以上实现（或未分析），需要查虚表
+    DISPATCH_SHAPE_COUNT
+};
+
+extern const char *dispatch_shape_names[DISPATCH_SHAPE_COUNT];
+
+// 一个调用点：解析到的方法及虚表位置、接收者的静态类型（SELF_TYPE 已换成所在类），
+// 以及 CHA 的结果
+struct DispatchSite {
+    Expression expr;
+    MethodSlot target;
+    Symbol receiver;
+    DispatchShape shape;
+    Symbol split_class;
+    method_class *split_method;
+};
+
+// 单个类的错误缓冲区（并行检查时使用）
+struct ClassDiagnostics {
+    ClassDiagnostics() : diagnostics(semant_max_class_errors) {}
+    DiagnosticBuffer diagnostics;
+    int count = 0;
+    std::vector<DispatchSite> dispatches;     // 该类中解析出的调用目标
+    std::unordered_set<Symbol> dependencies;  // 增量检查时记录引用到的类型
+};
+
+// 增量检查缓存中一个类的记录
+struct ClassCacheEntry {
+    unsigned long long fingerprint = 0;   // 类 AST 的指纹
+    int error_count = 0;
+    std::string errors;                   // 该类的错误，每行为 "<形式> <行号> <消息>"
+    std::vector<std::pair<std::string, unsigned long long> > deps;  // 依赖的类型及其接口签名
+};
+
+void load_class_cache(const char *path, std::unordered_map<std::string, ClassCacheEntry> &cache);
+void save_class_cache(const char *path, const std::unordered_map<std::string, ClassCacheEntry> &cache);
+
+// 常驻进程（semant-daemon）使用的内存中缓存，非 NULL 时代替 --cache 文件：
+// 与文件缓存的判断相同（指纹和依赖类型的签名都未变时跳过该类），只是不读写文件
+extern std::unordered_map<std::string, ClassCacheEntry> *semant_class_cache;
+// 常驻进程已算好的类指纹（按类对象索引），非 NULL 时 type_check 直接取用，
+// 表中没有的类才重新计算
+extern std::unordered_map<Class_, unsigned long long> *semant_class_fingerprints;
+
+// 表达式节点种类，用于类型检查时的 switch 分派
+enum ExprKind {
+    EXPR_UNKNOWN,
+    EXPR_INT_CONST,
+    EXPR_BOOL_CONST,
+    EXPR_STRING_CONST,
+    EXPR_NO_EXPR,
+    EXPR_VAR,
+    EXPR_ASSIGN,
+    EXPR_DISPATCH,
+    EXPR_STATIC_DISPATCH,
+    EXPR_COND,
+    EXPR_LOOP,
+    EXPR_BLOCK,
+    EXPR_LET,
+    EXPR_TYPCASE,
+    EXPR_NEW,
+    EXPR_ISVOID,
+    EXPR_PLUS,
+    EXPR_MINUS,
+    EXPR_TIMES,
+    EXPR_DIVIDE,
+    EXPR_LT,
+    EXPR_LEQ,
+    EXPR_EQ,
+    EXPR_COMP,
+    EXPR_NEG,
+    EXPR_KIND_COUNT
+};
+
+static_assert(EXPR_KIND_COUNT == SEMANT_STATS_EXPR_KINDS, "SemantStats 的表达式种类数需与 ExprKind 一致");
+
+extern const char *expr_kind_names[EXPR_KIND_COUNT];
+ExprKind expr_kind(Expression expr);
+method_class *as_method(Feature f);
+attr_class *as_attr(Feature f);
+// 二元算术/比较表达式的左右操作数，其他种类的表达式给出 NULL
+void binary_operands(ExprKind kind, Expression expr, Expression &left, Expression &right);
+
+// 对象环境：变量名 -> 类型，全部存放在 Arena 中。
+// 所有绑定在一个连续数组里，作用域只是数组上的一个下标；
+// 名字经哈希表直接找到当前绑定，查找不随 let/case 嵌套深度变慢
+class ObjectEnv {
+public:
+    explicit ObjectEnv(Arena &arena)
+        : arena(arena), bindings(arena), scopes(arena),
+          slots(NULL), slot_mask(0), slot_used(0) {}
+    
+    void enterscope() {
+        SEMANT_COUNT(scope_pushes);
+        scopes.push_back(bindings.size());
+    }
+    // 弹出本层绑定，并把每个名字的当前绑定恢复为被它遮蔽的那一个
+    void exitscope() {
+        SEMANT_COUNT(scope_pops);
+        size_t base = scopes.back();
+        scopes.pop_back();
+        while (bindings.size() > base) {
+            Binding &b = bindings.back();
+            slots[b.slot].current = b.shadowed;
+            bindings.pop_back();
+        }
+    }
+    void addid(Symbol name, Symbol type) {
+        size_t slot = find_slot(name);
+        Binding b = { type, slots[slot].current, slot };
+        slots[slot].current = bindings.size();
+        bindings.push_back(b);
+    }
+    // 返回名字当前可见的绑定，找不到返回 NULL；与嵌套深度无关
+    Symbol *lookup(Symbol name) {
+        SEMANT_COUNT(env_lookups);
+        if (slots == NULL) return NULL;
+        for (size_t i = hash(name) & slot_mask; ; i = (i + 1) & slot_mask) {
+            SEMANT_COUNT(env_lookup_steps);
+            if (slots[i].name == name) {
+                long current = slots[i].current;
+                return current >= 0 ? &bindings[current].type : NULL;
+            }
+            if (slots[i].name == NULL) return NULL;
+        }
+    }
+    void clear() {
+        bindings.clear();
+        scopes.clear();
+        if (slot_used > 0) {
+            for (size_t i = 0; i <= slot_mask; i++) slots[i] = Slot();
+            slot_used = 0;
+        }
+    }
+    // 丢弃存储（Arena reset 之后调用）
+    void release() {
+        bindings.release();
+        scopes.release();
+        slots = NULL;
+        slot_mask = 0;
+        slot_used = 0;
+    }
+    
+private:
+    // 每个名字在哈希表中占一个槽，current 指向它当前可见的绑定；
+    // 每个绑定记录被它遮蔽的上一个绑定，构成遮蔽链
+    struct Slot {
+        Symbol name = NULL;
+        long current = -1;
+    };
+    struct Binding {
+        Symbol type;
+        long shadowed;
+        size_t slot;
+    };
+    
+    Arena &arena;
+    ArenaVector<Binding> bindings;
+    ArenaVector<size_t> scopes;
+    Slot *slots;
+    size_t slot_mask;
+    size_t slot_used;
+    
+    static size_t hash(Symbol name) {
+        size_t h = reinterpret_cast<size_t>(name);
+        h ^= h >> 17;
+        h *= 0x9E3779B97F4A7C15ULL;
+        return h ^ (h >> 29);
+    }
+    
+    // 返回名字所在的槽，没有则新建；装载率不超过 1/2
+    size_t find_slot(Symbol name) {
+        if ((slot_used + 1) * 2 > slot_mask + 1 || slots == NULL) grow();
+        size_t i = hash(name) & slot_mask;
+        while (slots[i].name != NULL) {
+            if (slots[i].name == name) return i;
+            i = (i + 1) & slot_mask;
+        }
+        slots[i].name = name;
+        slot_used++;
+        return i;
+    }
+    
+    // 扩容后槽的位置改变，需要同步更新绑定中记录的槽号
+    void grow() {
+        size_t old_capacity = slots == NULL ? 0 : slot_mask + 1;
+        size_t capacity = old_capacity == 0 ? 32 : old_capacity * 2;
+        Slot *old_slots = slots;
+        slots = arena.allocate_array<Slot>(capacity);
+        for (size_t i = 0; i < capacity; i++) slots[i] = Slot();
+        slot_mask = capacity - 1;
+        size_t *moved = arena.allocate_array<size_t>(old_capacity);
+        for (size_t k = 0; k < old_capacity; k++) {
+            if (old_slots[k].name == NULL) continue;
+            size_t i = hash(old_slots[k].name) & slot_mask;
+            while (slots[i].name != NULL) i = (i + 1) & slot_mask;
+            slots[i] = old_slots[k];
+            moved[k] = i;
+        }
+        for (size_t b = 0; b < bindings.size(); b++) {
+            bindings[b].slot = moved[bindings[b].slot];
+        }
+    }
+};
+
+// ClassTable 构造函数依次执行的阶段
+enum SemantPhase {
+    PHASE_INSTALL_BASIC_CLASSES,
+    PHASE_BUILD_INHERITANCE_GRAPH,
+    PHASE_BUILD_HIERARCHY_INDEX,
+    PHASE_CHECK_INHERITANCE,
+    PHASE_BUILD_METHOD_TABLES,
+    PHASE_TYPE_CHECK,
+    PHASE_DEVIRTUALIZE,
+    PHASE_COUNT
+};
+
+extern const char *semant_phase_names[PHASE_COUNT];
+long peak_rss_kb();
+long current_rss_kb();
+
+class ClassTable;
+struct CheckFrame;
+void print_semant_stats(ClassTable *table, std::ostream &out);
+void write_semant_stats_json(ClassTable *table, std::ostream &out);
+
+// 基本类（Object、IO、Int、Bool、String）的个数，它们的类编号为 0..4
+const int BASIC_CLASS_COUNT = 5;
 
 // 语义分析器主类
 class ClassTable {
 private:
-    int semant_errors;
+    // 所有类：类名 -> 稠密类编号，以下按类编号索引的数组都以它为准
+    ClassRegistry registry;
+    
+    // 方法表：方法名 -> 方法定义及虚表位置（已包含继承来的方法），按类编号索引
+    typedef std::unordered_map<Symbol, MethodSlot> MethodTable;
+    std::vector<MethodTable> method_tables;
+    // 虚表：继承的方法保持父类中的位置，新方法依次追加，按类编号索引
+    std::vector<std::vector<method_class*> > vtables;
+    
+    // 每个 dispatch 表达式解析到的方法，供代码生成使用
+    std::vector<DispatchSite> dispatch_log;
+    std::unordered_map<Expression, size_t> dispatch_targets;   // 表达式 -> dispatch_log 下标，按需建立
+    // 属性表：属性名 -> 属性定义（已包含继承来的属性），按类编号索引
+    typedef std::unordered_map<Symbol, attr_class*> AttrTable;
+    std::vector<AttrTable> attr_tables;
+    
+    // 类型检查期间对象环境使用的内存，每检查完一个类 reset 一次
+    Arena env_arena;
+    
+    // 增量检查用的类型接口签名（按需计算）
+    std::unordered_map<Symbol, unsigned long long> interface_signatures;
+    unsigned long long interface_signature(Symbol type);
+    bool cache_entry_valid(const ClassCacheEntry &entry, unsigned long long fingerprint);
+    
+    // 继承树索引：父类编号、子类列表、DFS先序/后序区间、倍增祖先表
+    std::vector<int> parent_ids;
+    std::vector<int> child_begin;   // 类 v 的子类为 child_list[child_begin[v] .. child_begin[v+1])
+    std::vector<int> child_list;
+    std::vector<int> pre_order;
+    std::vector<int> post_order;
+    std::vector<int> depths;
+    std::vector<int> ancestors;     // ancestors[k * n + v]：v 的第 2^k 个祖先
+    int ancestor_levels;
+    unsigned lub_generation;        // LUB 缓存中属于本次检查的缓存项的代号
+    
     void install_basic_classes();
     void build_inheritance_graph();
+    void build_hierarchy_index();
     void check_inheritance();
+    void build_method_tables();
+    void build_class_tables(int class_id);
+    void install_builtin_tables(int class_id);
     void type_check();
+    void type_check_class(Class_ c, Arena &arena, const std::vector<Feature> *selected = NULL,
+                          std::vector<size_t> *ends = NULL);
+    void type_check_feature(Class_ c, Feature f, ObjectEnv &object_env, const char *filename);
+    bool type_check_reachable(const std::vector<Class_> &to_check);
+    
+    // --reachable 模式下可达的类（按类编号）和方法；未启用或退回全量检查时为空
+    std::vector<char> reachable_classes;
+    std::unordered_set<method_class*> reachable_methods;
+    void devirtualize();
+
+    void run_phase(SemantPhase phase, void (ClassTable::*step)());
+    SemantPhase current_phase;   // 正在执行的阶段，决定错误的种类
+    
+    ostream& begin_diagnostic(DiagnosticForm form, const char *filename, int line, Symbol class_name);
+    
+    bool basic_tables_built;   // 基本类的方法表和属性表只建一次
 
 public:
+    // 只安装基本类，之后可以用 check() 依次检查多个程序
+    ClassTable();
+    // 安装基本类并检查一个程序
     ClassTable(Classes);
     Classes classes;
-    SymbolTable<Symbol, Class_> *class_table;
+    
+    // 检查一个程序：丢弃上一个程序的类，保留基本类和已分配的表
+    void check(Classes cs);
+    
+    // 各阶段耗时（秒）和阶段前后常驻内存的增量（KB，释放内存时可为负）
+    double phase_seconds[PHASE_COUNT];
+    long phase_rss_delta_kb[PHASE_COUNT];
+    // 各形态的调用点个数（devirtualize 阶段统计）
+    int dispatch_shapes[DISPATCH_SHAPE_COUNT];
+    // 增量检查时被跳过（结果取自缓存）的类数
+    int skipped_classes;
+    // 类 AST 的内容指纹（增量检查用），不含类型标注，检查前后相同
+    static unsigned long long class_fingerprint(Class_ c);
     
     // 基本类成员变量（重要：必须用成员变量而非局部变量）
     Class_ Object_class;
@@ -37,16 +389,39 @@ public:
     
     // 类型检查相关方法
     Symbol type_check_expression(Expression expr, Symbol current_class, 
-                                SymbolTable<Symbol, Symbol> *&object_env, 
+                                ObjectEnv &object_env, 
                                 const char *filename);
+    Expression advance_call(CheckFrame &frame, Symbol method_name, Expressions actuals,
+                            Symbol result, Symbol &type, const char *filename);
+    Symbol check_var(Expression expr, ObjectEnv &object_env, const char *filename);
+    Symbol check_new(Expression expr, const char *filename);
     Symbol lub(Symbol type1, Symbol type2);
+    Symbol lub(const Symbol *types, size_t n);
+    int cached_lca(int a, int b);
     bool is_subtype(Symbol child, Symbol parent);
     Class_ get_class(Symbol name);
+    int class_id(Symbol name);
+    int lca(int a, int b);
     method_class* find_method(Symbol class_name, Symbol method_name);
-    void check_method_override(Class_ cls);
-    void semant_error(Class_ c);
-    void semant_error(Class_ c, const char *msg);
-    void semant_error(const char *filename, tree_node *t, const char *msg);
+    const MethodSlot *find_method_slot(Symbol class_name, Symbol method_name);
+    void record_dispatch(Expression expr, const MethodSlot &target, Symbol receiver);
+    
+    // 供代码生成使用：表达式的静态类型由 get_type() 取得；
+    // dispatch 表达式解析到的方法和虚表位置，未解析时返回 NULL
+    const MethodSlot *dispatch_target(Expression expr);
+    // 调用点的完整记录（含 CHA 形态），未解析时返回 NULL
+    const DispatchSite *dispatch_site(Expression expr);
+    // 类的虚表，类不存在时返回 NULL
+    const std::vector<method_class*> *vtable(Symbol class_name);
+    // --reachable 模式下类或方法是否从 Main.main 可达（未检查的部分可以不生成代码）；
+    // 未启用该模式时总是返回 true
+    bool is_reachable(Symbol class_name);
+    bool is_reachable(method_class *method);
+    void check_method_override(Class_ cls, method_class *method, method_class *parent_method);
+    ostream& semant_error();
+    ostream& semant_error(Class_ c);
+    ostream& semant_error(Class_ c, const char *msg);
+    ostream& semant_error(const char *filename, tree_node *t);
 };
 
 #endif
@@ -0,0 +1,37 @@
+(* Shapes.cl - 调用点形态：单态、双态、多态调用和静态调用（--stats 输出统计） *)
+
+class Main inherits IO {
+   main(): Object {
+      let s: Shape <- new Square,
+          r: Rect <- new Rect,
+          c: Circle <- new Circle
+      in
+         {
+            out_int(s.area());        (* Shape、Rect、Square、Circle 四个实现：多态 *)
+            out_int(r.area());        (* Rect、Square 两个实现：双态 *)
+            out_int(c.area());        (* Circle 没有子类：单态 *)
+            out_int(s.sides());       (* 只有 Shape 的实现：单态 *)
+            out_int(r@Shape.area());  (* 静态调用 *)
+         }
+   };
+};
+
+class Shape {
+   area(): Int { 0 };
+   sides(): Int { 0 };
+};
+
+class Rect inherits Shape {
+   w: Int <- 2;
+   h: Int <- 3;
+   area(): Int { w * h };
+};
+
+class Square inherits Rect {
+   area(): Int { 4 };
+};
+
+class Circle inherits Shape {
+   r: Int <- 1;
+   area(): Int { 3 * r * r };
+};
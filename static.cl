@@ -0,0 +1,27 @@
+(* Static.cl - 静态调用 e@T.m()：祖先检查、SELF_TYPE 返回值和参数检查 *)
+
+class Main inherits IO {
+   main(): Object {
+      let d: Derived <- new Derived in
+         {
+            out_int(d.value());
+            out_int(d@Base.value());
+            out_int(d.bump(2)@Base.value());
+            out_string(d@Base.name().concat("\n"));
+         }
+   };
+};
+
+class Base {
+   n: Int <- 1;
+
+   value(): Int { n };
+   bump(k: Int): SELF_TYPE { { n <- n + k; self; } };
+   name(): String { "base" };
+};
+
+class Derived inherits Base {
+   value(): Int { self@Base.value() * 10 };
+   bump(k: Int): SELF_TYPE { self@Base.bump(k + 1) };
+   name(): String { "derived" };
+};
@@ -14,7 +14,7 @@ YELLOW='\033[1;33m'
 NC='\033[0m' # No Color
 
 # Test files
-TEST_FILES=("good.cl" "bad.cl" "stack.cl" "complex.cl")
+TEST_FILES=("good.cl" "bad.cl" "stack.cl" "complex.cl" "chain.cl" "attrs.cl" "static.cl" "shapes.cl" "builtins.cl" "nested.cl" "caselub.cl" "reachorder.cl")
 PASS_COUNT=0
 FAIL_COUNT=0
 
@@ -47,7 +47,10 @@ for test_file in "${TEST_FILES[@]}"; do
     
     # Generate our output
     echo "Generating our output..."  
+    START_NS=$(date +%s%N)
     ./lexer "$test_file" 2>/dev/null | ./parser "$test_file" 2>&1 | ./mysemant "$test_file" 2>&1 > "test_results/my_$base_name.txt"
+    END_NS=$(date +%s%N)
+    echo "Time: $(( (END_NS - START_NS) / 1000000 )) ms"
     
     # Compare outputs
     if diff -w "test_results/official_$base_name.txt" "test_results/my_$base_name.txt" > /dev/null 2>&1; then
@@ -80,6 +83,47 @@ for test_file in "${TEST_FILES[@]}"; do
     fi
 done
 
+# --stats 计数：nested.cl 中每个表达式恰好计一次（需以 -DSEMANT_STATS 编译）
+echo
+echo "------------------------------------------"
+echo "Testing: --stats counts for nested.cl"
+echo "------------------------------------------"
+./lexer nested.cl 2>/dev/null | ./parser nested.cl 2>&1 | ./mysemant --stats-json test_results/stats_nested.json nested.cl > /dev/null 2>&1
+if ! grep -q '"type_check_expression"' test_results/stats_nested.json 2>/dev/null; then
+    echo -e "${YELLOW}SKIP: counters disabled (rebuild with -DSEMANT_STATS)${NC}"
+else
+    STATS_OK=1
+    for expected in '"plus": 3' '"int_const": 6' '"comp": 2' '"cond": 1' '"bool_const": 1' '"block": 1'; do
+        if ! grep -Eq "$expected(,|\$)" test_results/stats_nested.json; then
+            echo -e "${RED}missing $expected${NC}"
+            STATS_OK=0
+        fi
+    done
+    if [ $STATS_OK -eq 1 ]; then
+        echo -e "${GREEN}✅ PASS: --stats counts${NC}"
+        ((PASS_COUNT++))
+    else
+        echo -e "${RED}❌ FAIL: --stats counts${NC}"
+        ((FAIL_COUNT++))
+    fi
+fi
+
+# --reachable：可达方法的错误与全量检查的顺序相同，不可达的 c 不检查
+echo
+echo "------------------------------------------"
+echo "Testing: --reachable error order for reachorder.cl"
+echo "------------------------------------------"
+./lexer reachorder.cl 2>/dev/null | ./parser reachorder.cl 2>&1 | ./mysemant reachorder.cl 2>&1 | grep '^ERROR' | grep -v undefined_in_c > test_results/reach_full.txt
+./lexer reachorder.cl 2>/dev/null | ./parser reachorder.cl 2>&1 | ./mysemant --reachable reachorder.cl 2>&1 | grep '^ERROR' > test_results/reach_pruned.txt
+if [ -s test_results/reach_full.txt ] && diff test_results/reach_full.txt test_results/reach_pruned.txt > /dev/null; then
+    echo -e "${GREEN}✅ PASS: --reachable error order${NC}"
+    ((PASS_COUNT++))
+else
+    echo -e "${RED}❌ FAIL: --reachable error order${NC}"
+    diff -u test_results/reach_full.txt test_results/reach_pruned.txt | head -20
+    ((FAIL_COUNT++))
+fi
+
 echo
 echo "=========================================="
 echo "Test Summary"
@@ -0,0 +1,68 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// 任务窃取式并行循环：[0, n) 按连续区间分给各个线程，线程先处理
+// 自己队列的头部，空了再从其他线程队列的尾部窃取。
+// fn(i, worker) 中 worker 为线程编号（0..jobs-1），可用于索引线程私有数据。
+inline void parallel_for(size_t n, int jobs,
+                         const std::function<void(size_t, int)> &fn) {
+    if (jobs < 1) jobs = 1;
+    if ((size_t) jobs > n) jobs = n > 0 ? (int) n : 1;
+    if (jobs == 1) {
+        for (size_t i = 0; i < n; i++) fn(i, 0);
+        return;
+    }
+
+    struct WorkQueue {
+        std::mutex lock;
+        std::deque<size_t> items;
+    };
+    std::vector<WorkQueue> queues(jobs);
+    for (int w = 0; w < jobs; w++) {
+        size_t begin = n * w / jobs;
+        size_t end = n * (w + 1) / jobs;
+        for (size_t i = begin; i < end; i++) queues[w].items.push_back(i);
+    }
+
+    auto take = [&](int worker, size_t &item) -> bool {
+        // 先取自己的队列
+        {
+            std::lock_guard<std::mutex> guard(queues[worker].lock);
+            if (!queues[worker].items.empty()) {
+                item = queues[worker].items.front();
+                queues[worker].items.pop_front();
+                return true;
+            }
+        }
+        // 再从其他线程窃取
+        for (int k = 1; k < jobs; k++) {
+            WorkQueue &victim = queues[(worker + k) % jobs];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (!victim.items.empty()) {
+                item = victim.items.back();
+                victim.items.pop_back();
+                return true;
+            }
+        }
+        return false;
+    };
+
+    auto run = [&](int worker) {
+        size_t item;
+        while (take(worker, item)) fn(item, worker);
+    };
+
+    std::vector<std::thread> threads;
+    for (int w = 1; w < jobs; w++) threads.push_back(std::thread(run, w));
+    run(0);
+    for (size_t t = 0; t < threads.size(); t++) threads[t].join();
+}
+
+#endif